@@ -0,0 +1,240 @@
+#include "FreeRTOS.h"
+#include <platform/platform_stdlib.h>
+#include "platform_opts.h"
+
+#include "rtp_sink.h"
+#include "rtp_source.h"
+#include "rtsp_server.h"
+#include "rtp_avcodec/aac/aac.h"
+#include "sockets.h"
+#include "lwip/netif.h"
+
+#define WRITE_SIZE RTP_MTU_SIZE
+
+static int aac_frequency_index(u32 frequency)
+{
+        static const u32 freq_idx_map[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+        int i;
+        for(i = 0; i < sizeof(freq_idx_map) / sizeof(freq_idx_map[0]); i++)
+        {
+            if(frequency == freq_idx_map[i])
+                return i;
+        }
+        return 0xf; //frequency is written explicitly
+}
+
+/*
+ * "; config=<hex>" of AAC-LC AudioSpecificConfig (iso 14496-3 1.6.2.1) for
+ * sdp fmtp: object type, sampling frequency index or explicit 24 bit
+ * frequency, channel configuration and a zero GASpecificConfig.
+ */
+int aac_fmtp_config(u32 frequency, u8 channels, char *buf, int size)
+{
+        u8 asc[5];
+        int idx = aac_frequency_index(frequency);
+        int len, i, n;
+        if(idx != 0xf)
+        {
+            asc[0] = (AAC_OBJECT_LC << 3) | (idx >> 1);
+            asc[1] = ((idx & 1) << 7) | ((channels & 0xf) << 3);
+            len = 2;
+        }else{
+            asc[0] = (AAC_OBJECT_LC << 3) | (idx >> 1);
+            asc[1] = ((idx & 1) << 7) | ((frequency >> 17) & 0x7f);
+            asc[2] = (u8)(frequency >> 9);
+            asc[3] = (u8)(frequency >> 1);
+            asc[4] = ((frequency & 1) << 7) | ((channels & 0xf) << 3);
+            len = 5;
+        }
+        n = snprintf(buf, size, "; config=");
+        if(n < 0 || n + len * 2 >= size)
+            return -ENOMEM;
+        for(i = 0; i < len; i++)
+            n += snprintf(buf + n, size - n, "%02x", asc[i]);
+        return n;
+}
+
+//config of current sink parameters to sdp, cached sdp is invalidated only if it differs
+static void aac_publish_config(rtsp_sm_subsession *subsession)
+{
+        char fmtp[RTSP_FMTP_MAX];
+        rtp_sink_t *sink = subsession->sink;
+        if(aac_fmtp_config(sink->frequency, sink->nb_channels, fmtp, sizeof(fmtp)) > 0)
+            rtsp_sm_subsession_set_fmtp(subsession, fmtp);
+}
+
+int aac_hdl_extra_init(void *ctx)
+{
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        int pt = (sink->pt == RTP_PT_DYN_BASE) ? sink->pt + subsession->id : sink->pt;
+
+        struct rtp_aac_obj *aac_obj = malloc(sizeof(struct rtp_aac_obj));
+        if(aac_obj == NULL)
+        {
+            AAC_ERROR("allocate rtp aac object failed");
+            return -1;
+        }
+        memset(aac_obj, 0, sizeof(struct rtp_aac_obj));
+        //AAC-hbr sets marker on every packet that ends an access unit
+        rtp_fill_header(&pckt->rtphdr, 2, 0, 0, 0, 1, pt, 0, 0, 0);
+        memcpy(aac_obj->tmpl, &pckt->rtphdr, RTP_HDR_SZ);
+        pckt->extra = (void *)aac_obj;
+        aac_publish_config(subsession);
+        return 0;
+}
+
+void aac_hdl_extra_deinit(void *ctx)
+{
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        if(pckt->extra != NULL)
+            free(pckt->extra);
+        pckt->extra = NULL;
+}
+
+//AU-header section: 16 bit length in bits, then size << 3 of each unit, index and deltas are 0 for consecutive units
+static int aac_fill_au_headers(u8 *ptr, u16 *au_size, int au_nb)
+{
+        int i;
+        ptr[0] = (u8)((au_nb * AAC_AU_HDR_SZ * 8) >> 8);
+        ptr[1] = (u8)(au_nb * AAC_AU_HDR_SZ * 8);
+        for(i = 0; i < au_nb; i++)
+        {
+            ptr[2 + i * 2] = (u8)(au_size[i] >> 5);
+            ptr[3 + i * 2] = (u8)(au_size[i] << 3);
+        }
+        return 2 + au_nb * AAC_AU_HDR_SZ;
+}
+
+//send pending access units as one packet
+static int aac_flush(rtsp_sm_subsession *subsession, struct rtp_aac_obj *aac_obj)
+{
+        struct rtp_frag_list *list = &subsession->sink->frags;
+        u8 hdr[RTP_HDR_SZ + 2 + AAC_AGG_AU_MAX * AAC_AU_HDR_SZ];
+        int hdr_len, ret;
+
+        if(aac_obj->au_nb == 0)
+            return 0;
+        memcpy(hdr, aac_obj->tmpl, RTP_HDR_SZ);
+        hdr_len = RTP_HDR_SZ + aac_fill_au_headers(hdr + RTP_HDR_SZ, aac_obj->au_size, aac_obj->au_nb);
+        rtp_frag_list_reset(list, aac_obj->agg_ts);
+        ret = rtp_frag_list_add(list, hdr, hdr_len, aac_obj->agg, aac_obj->agg_len);
+        if(ret == 0)
+        {
+            aac_obj->pkt_cnt++;
+            ret = rtsp_sm_subsession_fanout(subsession, list);
+        }
+        //pending buffer is free again once fan-out is done
+        aac_obj->au_nb = 0;
+        aac_obj->agg_len = 0;
+        return ret;
+}
+
+//access unit larger than a packet, every fragment carries the AU-header of the whole unit, rfc 3640 3.2.3
+static int aac_send_fragmented(rtsp_sm_subsession *subsession, struct rtp_aac_obj *aac_obj, u8 *au, int size, u32 ts)
+{
+        struct rtp_frag_list *list = &subsession->sink->frags;
+        u8 hdr[RTP_HDR_SZ + 2 + AAC_AU_HDR_SZ];
+        u16 au_size = size;
+        int hdr_len, room, len;
+
+        memcpy(hdr, aac_obj->tmpl, RTP_HDR_SZ);
+        hdr_len = RTP_HDR_SZ + aac_fill_au_headers(hdr + RTP_HDR_SZ, &au_size, 1);
+        room = WRITE_SIZE - hdr_len;
+        rtp_frag_list_reset(list, ts);
+        while(size > 0)
+        {
+            len = (size > room) ? room : size;
+            if(rtp_frag_list_add(list, hdr, hdr_len, au, len) < 0)
+                return -ENOMEM;
+            //marker only on the fragment that completes the unit
+            if(len < size)
+                rtp_frag_hdr(list, list->frag_cnt - 1)[1] &= ~0x80;
+            au += len;
+            size -= len;
+        }
+        aac_obj->frag_cnt++;
+        aac_obj->pkt_cnt += list->frag_cnt;
+        return rtsp_sm_subsession_fanout(subsession, list);
+}
+
+//queue one access unit, a packet goes out when it is full, holds AAC_AGG_AU_MAX units or timestamps jump
+static int aac_add_au(rtsp_sm_subsession *subsession, struct rtp_aac_obj *aac_obj, u8 *au, int size, u32 ts)
+{
+        int ret = 0;
+
+        if(size <= 0 || size > AAC_AU_SIZE_MAX)
+            return -EINVAL;
+        aac_obj->au_cnt++;
+        //units of one packet must be consecutive, there is no index delta to skip lost ones
+        if(aac_obj->au_nb > 0 && ts != aac_obj->agg_ts + aac_obj->au_nb * AAC_FRAME_SAMPLES)
+        {
+            aac_obj->gap_cnt++;
+            if(aac_flush(subsession, aac_obj) < 0)
+                ret = -EAGAIN;
+        }
+        if(aac_obj->au_nb > 0 && RTP_HDR_SZ + 2 + (aac_obj->au_nb + 1) * AAC_AU_HDR_SZ + aac_obj->agg_len + size > WRITE_SIZE)
+        {
+            if(aac_flush(subsession, aac_obj) < 0)
+                ret = -EAGAIN;
+        }
+        if(RTP_HDR_SZ + 2 + AAC_AU_HDR_SZ + size > WRITE_SIZE)
+            return (aac_send_fragmented(subsession, aac_obj, au, size, ts) < 0) ? -EAGAIN : ret;
+        if(aac_obj->au_nb == 0)
+            aac_obj->agg_ts = ts;
+        memcpy(aac_obj->agg + aac_obj->agg_len, au, size);
+        aac_obj->agg_len += size;
+        aac_obj->au_size[aac_obj->au_nb++] = size;
+        if(aac_obj->au_nb == AAC_AGG_AU_MAX && aac_flush(subsession, aac_obj) < 0)
+            ret = -EAGAIN;
+        return ret;
+}
+
+int aac_hdl_send(void *ctx)
+{
+	rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        struct rtp_aac_obj *aac_obj = (struct rtp_aac_obj *)pckt->extra;
+        u8 *ptr = pckt->data;
+        int left = pckt->len;
+        u32 ts = pckt->ts;
+        int hdr_len, len, adts = 0;
+        int ret = 0;
+
+        //adts input may carry several units per frame, raw input is one unit per frame
+        while(left >= AAC_ADTS_HDR_SZ && ptr[0] == 0xff && (ptr[1] & 0xf0) == 0xf0)
+        {
+            hdr_len = (ptr[1] & 0x01) ? AAC_ADTS_HDR_SZ : AAC_ADTS_HDR_SZ + 2;
+            len = ((ptr[3] & 0x03) << 11) | (ptr[4] << 3) | (ptr[5] >> 5);
+            if(len <= hdr_len || len > left)
+                break;
+            if(aac_add_au(subsession, aac_obj, ptr + hdr_len, len - hdr_len, ts) < 0)
+                ret = -EAGAIN;
+            ptr += len;
+            left -= len;
+            ts += AAC_FRAME_SAMPLES;
+            adts = 1;
+        }
+        if(!adts && left > 0)
+            ret = aac_add_au(subsession, aac_obj, ptr, left, ts);
+        sink->packet_cnt++;
+
+        return ret;
+}
+
+int aac_hdl_recv(void *ctx)
+{
+    return 0;
+}
+
+struct avcodec_handle_ops aac_hdl_ops =
+{
+        .packet_extra_init = aac_hdl_extra_init,
+        .packet_extra_deinit = aac_hdl_extra_deinit,
+	.packet_send = aac_hdl_send,
+	.packet_recv = aac_hdl_recv
+};
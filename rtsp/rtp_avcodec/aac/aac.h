@@ -0,0 +1,43 @@
+#ifndef _AAC_H_
+#define _AAC_H_
+
+#include "dlist.h"      //list management
+#include "basic_types.h"
+#include "osdep_service.h"
+
+#define AAC_DEBUG 0
+
+#if AAC_DEBUG
+#define AAC_PRINTF(fmt, args...)    printf("\n\r%s: " fmt, __FUNCTION__, ## args)
+#define AAC_ERROR(fmt, args...)     printf("\n\r%s: " fmt, __FUNCTION__, ## args)
+#else
+#define AAC_PRINTF(fmt, args...)
+#define AAC_ERROR(fmt, args...)
+#endif
+
+#define AAC_OBJECT_LC           2
+#define AAC_FRAME_SAMPLES       1024    /* samples per access unit, rtp timestamp advance */
+#define AAC_ADTS_HDR_SZ         7       /* 9 with crc */
+
+/* AAC-hbr, rfc 3640 3.3.6: 16 bit AU-header of 13 bit size and 3 bit index(-delta) */
+#define AAC_AU_HDR_SZ           2
+#define AAC_AU_SIZE_MAX         8191
+//access units held back to share one packet, each one adds 1024 samples of latency
+#define AAC_AGG_AU_MAX          4
+
+struct rtp_aac_obj
+{
+        u8 tmpl[RTP_HDR_SZ];    /* rtp header template, seq/ts/ssrc patched per destination */
+        //access units waiting for a packet, data back to back as sent
+        u8 agg[RTP_MTU_SIZE];
+        int agg_len;
+        u16 au_size[AAC_AGG_AU_MAX];
+        int au_nb;
+        u32 agg_ts;             /* rtp timestamp of first pending access unit */
+        u32 au_cnt;
+        u32 pkt_cnt;
+        u32 frag_cnt;           /* access units larger than a packet */
+        u32 gap_cnt;
+};
+
+#endif /*_AAC_H_*/
@@ -8,4 +8,6 @@ extern struct avcodec_handle_ops h264_hdl_ops;
 extern struct avcodec_handle_ops g711_hdl_ops;
 extern struct avcodec_handle_ops aac_hdl_ops; 
 
+int aac_fmtp_config(u32 frequency, u8 channels, char *buf, int size);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,213 @@
+#include "FreeRTOS.h"
+#include <platform/platform_stdlib.h>
+#include "platform_opts.h"
+
+#include "rtp_sink.h"
+#include "rtp_source.h"
+#include "rtsp_server.h"
+#include "rtp_avcodec/g711/g711.h"
+#include "sockets.h"
+#include "lwip/netif.h"
+
+#define ULAW_BIAS       0x84
+#define ULAW_CLIP       32635
+
+//segment of a 8 bit magnitude, floor(log2(x)) with 0 for 0 and 1, replaces the segment search of the reference coder
+#define R2(x)   x, x
+#define R4(x)   R2(x), R2(x)
+#define R8(x)   R4(x), R4(x)
+#define R16(x)  R8(x), R8(x)
+#define R32(x)  R16(x), R16(x)
+#define R64(x)  R32(x), R32(x)
+#define R128(x) R64(x), R64(x)
+static const u8 g711_seg[256] = {0, 0, R2(1), R4(2), R8(3), R16(4), R32(5), R64(6), R128(7)};
+
+//itu-t g.711 mu-law, same output as the classic reference encoder
+void g711_ulaw_encode(s16 *pcm, u8 *out, int n)
+{
+        int i, s, sign, seg;
+        for(i = 0; i < n; i++)
+        {
+            s = pcm[i];
+            sign = (s >> 8) & 0x80;
+            if(sign)
+                s = -s;
+            if(s > ULAW_CLIP)
+                s = ULAW_CLIP;
+            s += ULAW_BIAS;
+            seg = g711_seg[(s >> 7) & 0xff];
+            out[i] = ~(sign | (seg << 4) | ((s >> (seg + 3)) & 0x0f));
+        }
+}
+
+//itu-t g.711 a-law on the 13 bit magnitude
+void g711_alaw_encode(s16 *pcm, u8 *out, int n)
+{
+        int i, s, mask, seg;
+        for(i = 0; i < n; i++)
+        {
+            s = pcm[i] >> 3;
+            if(s >= 0)
+                mask = 0xd5;
+            else{
+                mask = 0x55;
+                s = -s - 1;
+            }
+            if(s > 0xfff)
+            {
+                out[i] = 0x7f ^ mask;
+                continue;
+            }
+            seg = g711_seg[s >> 4];
+            out[i] = ((seg << 4) | ((s >> ((seg < 2) ? 1 : seg)) & 0x0f)) ^ mask;
+        }
+}
+
+int g711_hdl_extra_init(void *ctx)
+{
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        int ptime = (sink->ptime != 0) ? sink->ptime : RTP_PTIME_DEF;
+
+        struct rtp_g711_obj *g711_obj = malloc(sizeof(struct rtp_g711_obj));
+        if(g711_obj == NULL)
+        {
+            G711_ERROR("allocate rtp g711 object failed");
+            return -1;
+        }
+        memset(g711_obj, 0, sizeof(struct rtp_g711_obj));
+        g711_obj->pkt_samples = sink->frequency / 1000 * ptime;
+        if(g711_obj->pkt_samples <= 0 || g711_obj->pkt_samples > G711_PKT_MAX)
+            g711_obj->pkt_samples = G711_PKT_MAX / 2;
+        rtp_fill_header(&pckt->rtphdr, 2, 0, 0, 0, 0, sink->pt, 0, 0, 0);
+        memcpy(g711_obj->tmpl, &pckt->rtphdr, RTP_HDR_SZ);
+        pckt->extra = (void *)g711_obj;
+        return 0;
+}
+
+void g711_hdl_extra_deinit(void *ctx)
+{
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        if(pckt->extra != NULL)
+            free(pckt->extra);
+        pckt->extra = NULL;
+}
+
+static int g711_add(struct rtp_frag_list *list, struct rtp_g711_obj *g711_obj, u8 *data, int len, u32 ts_delta)
+{
+        if(rtp_frag_list_add(list, g711_obj->tmpl, RTP_HDR_SZ, data, len) < 0)
+            return -ENOMEM;
+        list->frag[list->frag_cnt - 1].ts_delta = ts_delta;
+        g711_obj->pkt_cnt++;
+        return 0;
+}
+
+/*
+ * Queue encoded samples starting at rtp timestamp ts. Whole packets are sent
+ * now, straight from the input where possible, the remainder is carried in
+ * acc until the next frame completes it. Timestamp advances one per sample.
+ */
+static int g711_feed(rtsp_sm_subsession *subsession, struct rtp_g711_obj *g711_obj, u8 *in, int len, u32 ts)
+{
+        struct rtp_frag_list *list = &subsession->sink->frags;
+        int pkt = g711_obj->pkt_samples;
+        u32 delta = 0;
+        int n, ret = 0;
+
+        //frames were dropped in between, send pending samples short instead of splicing them to later audio
+        if(g711_obj->acc_len > 0 && ts != g711_obj->acc_ts + g711_obj->acc_len)
+        {
+            g711_obj->gap_cnt++;
+            rtp_frag_list_reset(list, g711_obj->acc_ts);
+            if(g711_add(list, g711_obj, g711_obj->acc, g711_obj->acc_len, 0) == 0)
+                ret = rtsp_sm_subsession_fanout(subsession, list);
+            g711_obj->acc_len = 0;
+        }
+        if(g711_obj->acc_len == 0)
+            g711_obj->acc_ts = ts;
+        rtp_frag_list_reset(list, g711_obj->acc_ts);
+        if(g711_obj->acc_len > 0)
+        {
+            n = pkt - g711_obj->acc_len;
+            if(n > len)
+                n = len;
+            memcpy(g711_obj->acc + g711_obj->acc_len, in, n);
+            g711_obj->acc_len += n;
+            in += n;
+            len -= n;
+            if(g711_obj->acc_len < pkt)
+                return ret;
+            if(g711_add(list, g711_obj, g711_obj->acc, pkt, delta) < 0)
+                return -ENOMEM;
+            delta += pkt;
+        }
+        while(len >= pkt)
+        {
+            if(g711_add(list, g711_obj, in, pkt, delta) < 0)
+                break;
+            in += pkt;
+            len -= pkt;
+            delta += pkt;
+        }
+        if(list->frag_cnt > 0)
+            ret = rtsp_sm_subsession_fanout(subsession, list);
+        //acc is free again once fan-out is done, anything left over a full list is dropped
+        if(len > pkt)
+        {
+            ret = -ENOMEM;
+            len = 0;
+        }
+        memcpy(g711_obj->acc, in, len);
+        g711_obj->acc_len = len;
+        g711_obj->acc_ts = list->ts + delta;
+        return ret;
+}
+
+int g711_hdl_send(void *ctx)
+{
+	rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        struct rtp_g711_obj *g711_obj = (struct rtp_g711_obj *)pckt->extra;
+        s16 *pcm = (s16 *)pckt->data;
+        int samples, done, n;
+        int ret = 0;
+
+        if(!rtp_sink_is_pcm_input(sink))
+        {
+            ret = g711_feed(subsession, g711_obj, pckt->data, pckt->len, pckt->ts);
+        }else{
+            //encode in chunks, packets of a chunk are sent before the buffer is reused
+            samples = pckt->len / 2;
+            for(done = 0; done < samples && ret >= 0; done += n)
+            {
+                n = samples - done;
+                if(n > G711_ENC_CHUNK)
+                    n = G711_ENC_CHUNK;
+                if(sink->codec_id == AV_CODEC_ID_PCMA)
+                    g711_alaw_encode(pcm + done, g711_obj->enc, n);
+                else
+                    g711_ulaw_encode(pcm + done, g711_obj->enc, n);
+                ret = g711_feed(subsession, g711_obj, g711_obj->enc, n, pckt->ts + done);
+            }
+        }
+        sink->packet_cnt++;
+
+        return ret;
+}
+
+int g711_hdl_recv(void *ctx)
+{
+    return 0;
+}
+
+struct avcodec_handle_ops g711_hdl_ops =
+{
+        .packet_extra_init = g711_hdl_extra_init,
+        .packet_extra_deinit = g711_hdl_extra_deinit,
+	.packet_send = g711_hdl_send,
+	.packet_recv = g711_hdl_recv
+};
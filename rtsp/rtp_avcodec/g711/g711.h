@@ -0,0 +1,38 @@
+#ifndef _G711_H_
+#define _G711_H_
+
+#include "dlist.h"      //list management
+#include "basic_types.h"
+#include "osdep_service.h"
+
+#define G711_DEBUG 0
+
+#if G711_DEBUG
+#define G711_PRINTF(fmt, args...)    printf("\n\r%s: " fmt, __FUNCTION__, ## args)
+#define G711_ERROR(fmt, args...)     printf("\n\r%s: " fmt, __FUNCTION__, ## args)
+#else
+#define G711_PRINTF(fmt, args...)
+#define G711_ERROR(fmt, args...)
+#endif
+
+#define G711_PTIME_MAX          40
+#define G711_PKT_MAX            (8 * G711_PTIME_MAX)   /* one byte per sample at 8 kHz */
+#define G711_ENC_CHUNK          1024                    /* linear pcm samples encoded per pass */
+
+struct rtp_g711_obj
+{
+        u8 tmpl[RTP_HDR_SZ];    /* rtp header template, seq/ts/ssrc patched per destination */
+        int pkt_samples;        /* samples per packet from ptime */
+        //samples carried over to next frame, less than one packet
+        u8 acc[G711_PKT_MAX];
+        int acc_len;
+        u32 acc_ts;             /* rtp timestamp of acc[0] */
+        u8 enc[G711_ENC_CHUNK]; /* encoded linear pcm input */
+        u32 pkt_cnt;
+        u32 gap_cnt;            /* pending samples sent short because timestamps jumped */
+};
+
+void g711_ulaw_encode(s16 *pcm, u8 *out, int n);
+void g711_alaw_encode(s16 *pcm, u8 *out, int n);
+
+#endif /*_G711_H_*/
@@ -0,0 +1,313 @@
+#include "FreeRTOS.h"
+#include <platform/platform_stdlib.h>
+#include "platform_opts.h"
+
+#include "rtp_sink.h"
+#include "rtp_source.h"
+#include "rtsp_server.h"
+#include "rtp_avcodec/h264/h264.h"
+#include "sdp.h"
+#include "sockets.h"
+#include "lwip/netif.h"
+
+//"; profile-level-id=xxxxxx; sprop-parameter-sets=" + two base64 sets + ',' + NUL
+#define H264_SPROP_FMTP_LEN     (48 + 2 * ((H264_SPROP_NAL_MAX + 2) / 3 * 4) + 2)
+#if H264_SPROP_FMTP_LEN > RTSP_FMTP_MAX
+#error "RTSP_FMTP_MAX cannot hold sprop of H264_SPROP_NAL_MAX parameter sets"
+#endif
+
+#define WRITE_SIZE RTP_MTU_SIZE
+
+/*
+ * Next nal unit of an annex-b byte stream. Start codes are found by memchr on
+ * their 0x01 byte and checking the two zero bytes before it, emulation
+ * prevention guarantees 00 00 01 never shows up inside a nal. Trailing zero
+ * bytes (4 byte start codes, trailing_zero_8bits) are not part of the nal.
+ */
+static int h264_next_nal(u8 **pos, u8 *end, struct h264_nal *nal)
+{
+        u8 *ptr = *pos, *next = NULL;
+        u8 *s;
+
+        //find start of this nal
+        for(s = ptr + 2; s < end && (s = memchr(s, 0x01, end - s)) != NULL; s++)
+        {
+            if(s[-1] == 0 && s[-2] == 0)
+            {
+                ptr = s + 1;
+                break;
+            }
+        }
+        if(s == NULL || s >= end || ptr >= end)
+            return -1;
+        //its end is the next start code or end of frame
+        for(s = ptr + 2; s < end && (s = memchr(s, 0x01, end - s)) != NULL; s++)
+        {
+            if(s[-1] == 0 && s[-2] == 0)
+            {
+                next = s - 2;
+                break;
+            }
+        }
+        if(next == NULL)
+            next = end;
+        *pos = next;
+        while(next > ptr && next[-1] == 0)
+            next--;
+        nal->data = ptr;
+        nal->len = next - ptr;
+        return 0;
+}
+
+int h264_hdl_extra_init(void *ctx)
+{
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+
+        struct rtp_h264_obj *h264_obj = malloc(sizeof(struct rtp_h264_obj));
+        if(h264_obj == NULL)
+        {
+            H264_ERROR("allocate rtp h264 object failed");
+            return -1;
+        }
+        memset(h264_obj, 0, sizeof(struct rtp_h264_obj));
+        pckt->extra = (void *)h264_obj;
+        return 0;
+}
+
+void h264_hdl_extra_deinit(void *ctx)
+{
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        if(pckt->extra != NULL)
+            free(pckt->extra);
+        pckt->extra = NULL;
+}
+
+//rtp header is the same for every packet of stream, dynamic payload type follows the one in sdp
+static void h264_build_tmpl(rtsp_sm_subsession *subsession, struct rtp_h264_obj *h264_obj)
+{
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        int pt = (sink->pt == RTP_PT_DYN_BASE) ? sink->pt + subsession->id : sink->pt;
+
+        rtp_fill_header(&pckt->rtphdr, 2, 0, 0, 0, 0, pt, 0, 0, 0);
+        memcpy(h264_obj->tmpl, &pckt->rtphdr, RTP_HDR_SZ);
+        h264_obj->tmpl_len = RTP_HDR_SZ;
+}
+
+//one nal in one packet, rfc 6184 5.6
+static int h264_send_single(struct rtp_frag_list *list, struct rtp_h264_obj *h264_obj, struct h264_nal *nal)
+{
+        h264_obj->single_cnt++;
+        return rtp_frag_list_add(list, h264_obj->tmpl, h264_obj->tmpl_len, nal->data, nal->len);
+}
+
+/*
+ * Pending small nals as one STAP-A, rfc 6184 5.7.1. Indicator, size fields
+ * and all nals but the last are built in the fragment header, the last nal
+ * goes by reference like any other payload.
+ */
+static int h264_flush_stap(struct rtp_frag_list *list, struct rtp_h264_obj *h264_obj)
+{
+        u8 hdr[RTP_FRAG_HDR_MAX];
+        u8 *ptr = hdr + h264_obj->tmpl_len;
+        struct h264_nal *last;
+        u8 f = 0, nri = 0;
+        int i;
+
+        if(h264_obj->stap_nb == 0)
+            return 0;
+        last = &h264_obj->stap[h264_obj->stap_nb - 1];
+        h264_obj->stap_size = 1; //STAP-A nal header
+        if(h264_obj->stap_nb == 1)
+        {
+            h264_obj->stap_nb = 0;
+            return h264_send_single(list, h264_obj, last);
+        }
+        memcpy(hdr, h264_obj->tmpl, h264_obj->tmpl_len);
+        for(i = 0; i < h264_obj->stap_nb; i++)
+        {
+            f |= H264_NAL_F(h264_obj->stap[i].data[0]);
+            if(H264_NAL_NRI(h264_obj->stap[i].data[0]) > nri)
+                nri = H264_NAL_NRI(h264_obj->stap[i].data[0]);
+        }
+        *ptr++ = f | nri | H264_NAL_STAP_A;
+        for(i = 0; i < h264_obj->stap_nb; i++)
+        {
+            *ptr++ = (u8)(h264_obj->stap[i].len >> 8);
+            *ptr++ = (u8)h264_obj->stap[i].len;
+            if(&h264_obj->stap[i] == last)
+                break;
+            memcpy(ptr, h264_obj->stap[i].data, h264_obj->stap[i].len);
+            ptr += h264_obj->stap[i].len;
+        }
+        h264_obj->stap_nb = 0;
+        h264_obj->stap_cnt++;
+        return rtp_frag_list_add(list, hdr, ptr - hdr, last->data, last->len);
+}
+
+//nal too large for one packet as FU-A fragments, rfc 6184 5.8
+static int h264_send_fu_a(struct rtp_frag_list *list, struct rtp_h264_obj *h264_obj, struct h264_nal *nal)
+{
+        u8 hdr[RTP_HDR_SZ + 2];
+        u8 *fu = hdr + h264_obj->tmpl_len;
+        u8 *data = nal->data + 1; //nal header is carried in FU indicator and header
+        int left = nal->len - 1;
+        int room = WRITE_SIZE - h264_obj->tmpl_len - 2;
+        int len;
+
+        memcpy(hdr, h264_obj->tmpl, h264_obj->tmpl_len);
+        fu[0] = (nal->data[0] & 0xe0) | H264_NAL_FU_A;
+        fu[1] = H264_FU_S | H264_NAL_TYPE(nal->data[0]);
+        while(left > 0)
+        {
+            len = (left > room) ? room : left;
+            if(len == left)
+                fu[1] |= H264_FU_E;
+            if(rtp_frag_list_add(list, hdr, h264_obj->tmpl_len + 2, data, len) < 0)
+                return -ENOMEM;
+            fu[1] &= ~H264_FU_S;
+            data += len;
+            left -= len;
+            h264_obj->fu_cnt++;
+        }
+        return 0;
+}
+
+//parameter sets, SEI and delimiters are small and sent right before the slice they belong to
+static int h264_nal_aggregatable(struct h264_nal *nal)
+{
+        u8 type = H264_NAL_TYPE(nal->data[0]);
+        return (type == H264_NAL_SEI || type == H264_NAL_SPS || type == H264_NAL_PPS || type == H264_NAL_AUD);
+}
+
+//keep parameter set if it differs from the last one of its kind
+static void h264_sprop_capture(struct rtp_h264_obj *h264_obj, struct h264_nal *nal)
+{
+        int is_sps = (H264_NAL_TYPE(nal->data[0]) == H264_NAL_SPS);
+        u8 *buf = is_sps ? h264_obj->sps : h264_obj->pps;
+        int *len = is_sps ? &h264_obj->sps_len : &h264_obj->pps_len;
+        if(nal->len > H264_SPROP_NAL_MAX || (nal->len == *len && memcmp(buf, nal->data, nal->len) == 0))
+            return;
+        memcpy(buf, nal->data, nal->len);
+        *len = nal->len;
+        h264_obj->sprop_dirty = 1;
+}
+
+//profile-level-id from SPS and base64 parameter sets as fmtp of subsession, sdp is rebuilt only if they changed
+static void h264_sprop_publish(rtsp_sm_subsession *subsession, struct rtp_h264_obj *h264_obj)
+{
+        char fmtp[RTSP_FMTP_MAX];
+        int n, ret;
+        if(!h264_obj->sprop_dirty || h264_obj->sps_len < 4 || h264_obj->pps_len == 0)
+            return;
+        h264_obj->sprop_dirty = 0;
+        n = snprintf(fmtp, sizeof(fmtp), "; profile-level-id=%02x%02x%02x; sprop-parameter-sets=", \
+                     h264_obj->sps[1], h264_obj->sps[2], h264_obj->sps[3]);
+        if((ret = sdp_base64_encode(h264_obj->sps, h264_obj->sps_len, fmtp + n, sizeof(fmtp) - n - 1)) < 0)
+        {
+            H264_ERROR("sprop skipped, sps of %d bytes does not fit fmtp", h264_obj->sps_len);
+            return;
+        }
+        n += ret;
+        fmtp[n++] = ',';
+        if(sdp_base64_encode(h264_obj->pps, h264_obj->pps_len, fmtp + n, sizeof(fmtp) - n) < 0)
+        {
+            H264_ERROR("sprop skipped, pps of %d bytes does not fit fmtp", h264_obj->pps_len);
+            return;
+        }
+        if(rtsp_sm_subsession_set_fmtp(subsession, fmtp) > 0)
+            H264_PRINTF("sprop changed:%s", fmtp);
+}
+
+//cut current access unit into the shared fragment list of sink, destination fields are left for fan-out
+static int h264_packetize(rtsp_sm_subsession *subsession)
+{
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        struct rtp_h264_obj *h264_obj = (struct rtp_h264_obj *)pckt->extra;
+        struct rtp_frag_list *list = &sink->frags;
+        u8 *pos = pckt->data, *end = pckt->data + pckt->len;
+        struct h264_nal nal;
+        int room, ret = 0;
+
+        rtp_frag_list_reset(list, pckt->ts);
+        if(h264_obj->tmpl_len == 0)
+            h264_build_tmpl(subsession, h264_obj);
+        room = WRITE_SIZE - h264_obj->tmpl_len;
+        h264_obj->stap_nb = 0;
+        h264_obj->stap_size = 1; //STAP-A nal header
+        while(h264_next_nal(&pos, end, &nal) == 0)
+        {
+            //empty nal between two start codes
+            if(nal.len == 0)
+                continue;
+            h264_obj->nal_cnt++;
+            if(H264_NAL_TYPE(nal.data[0]) == H264_NAL_SPS || H264_NAL_TYPE(nal.data[0]) == H264_NAL_PPS)
+                h264_sprop_capture(h264_obj, &nal);
+            if(h264_nal_aggregatable(&nal) && 1 + 2 + nal.len <= room)
+            {
+                //flush first if this one would not fit, the last member travels by reference so header keeps the rest
+                if(h264_obj->stap_nb == H264_STAP_NAL_MAX || h264_obj->stap_size + 2 + nal.len > room || \
+                   h264_obj->stap_size + 2 > H264_STAP_SIZE_MAX)
+                {
+                    if((ret = h264_flush_stap(list, h264_obj)) < 0)
+                        return ret;
+                }
+                h264_obj->stap[h264_obj->stap_nb++] = nal;
+                h264_obj->stap_size += 2 + nal.len;
+                continue;
+            }
+            if((ret = h264_flush_stap(list, h264_obj)) < 0)
+                return ret;
+            if(nal.len <= room)
+                ret = h264_send_single(list, h264_obj, &nal);
+            else
+                ret = h264_send_fu_a(list, h264_obj, &nal);
+            if(ret < 0)
+                return ret;
+        }
+        if((ret = h264_flush_stap(list, h264_obj)) < 0)
+            return ret;
+        if(list->frag_cnt == 0)
+            return -EINVAL;
+        h264_sprop_publish(subsession, h264_obj);
+        //marker on last packet of access unit
+        rtp_frag_hdr(list, list->frag_cnt - 1)[1] |= 0x80;
+        return 0;
+}
+
+int h264_hdl_send(void *ctx)
+{
+	rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        int ret;
+
+        //packetize once, then every viewer gets the same packets
+        ret = h264_packetize(subsession);
+        if(ret < 0)
+        {
+            H264_ERROR("packetize access unit failed %d", ret);
+            return ret;
+        }
+        ret = rtsp_sm_subsession_fanout(subsession, &sink->frags);
+        sink->packet_cnt++;
+
+        return ret;
+}
+
+int h264_hdl_recv(void *ctx)
+{
+    return 0;
+}
+
+struct avcodec_handle_ops h264_hdl_ops =
+{
+        .packet_extra_init = h264_hdl_extra_init,
+        .packet_extra_deinit = h264_hdl_extra_deinit,
+	.packet_send = h264_hdl_send,
+	.packet_recv = h264_hdl_recv
+};
@@ -0,0 +1,69 @@
+#ifndef _H264_H_
+#define _H264_H_
+
+#include "dlist.h"      //list management
+#include "basic_types.h"
+#include "osdep_service.h"
+
+#define H264_DEBUG 0
+
+#if H264_DEBUG
+#define H264_PRINTF(fmt, args...)    printf("\n\r%s: " fmt, __FUNCTION__, ## args)
+#define H264_ERROR(fmt, args...)     printf("\n\r%s: " fmt, __FUNCTION__, ## args)
+#else
+#define H264_PRINTF(fmt, args...)
+#define H264_ERROR(fmt, args...)
+#endif
+
+/* nal unit types, rfc 6184 5.2 */
+#define H264_NAL_SLICE          1
+#define H264_NAL_IDR            5
+#define H264_NAL_SEI            6
+#define H264_NAL_SPS            7
+#define H264_NAL_PPS            8
+#define H264_NAL_AUD            9
+#define H264_NAL_STAP_A         24
+#define H264_NAL_FU_A           28
+
+#define H264_NAL_TYPE(b)        ((b) & 0x1f)
+#define H264_NAL_NRI(b)         ((b) & 0x60)
+#define H264_NAL_F(b)           ((b) & 0x80)
+
+#define H264_FU_S               0x80
+#define H264_FU_E               0x40
+
+/* STAP-A aggregates are built in the fragment header, so they are bound by its size */
+#define H264_STAP_NAL_MAX       8
+#define H264_STAP_SIZE_MAX      (RTP_FRAG_HDR_MAX - RTP_HDR_SZ)
+
+/* parameter sets longer than this are sent in-band only, not in sprop-parameter-sets */
+#define H264_SPROP_NAL_MAX      64
+
+struct h264_nal
+{
+        u8 *data;               /* starts at nal header byte */
+        int len;
+};
+
+struct rtp_h264_obj
+{
+        u8 tmpl[RTP_HDR_SZ];    /* rtp header template, seq/ts/ssrc patched per destination */
+        int tmpl_len;
+        //small non-VCL nals waiting to be aggregated
+        struct h264_nal stap[H264_STAP_NAL_MAX];
+        int stap_nb;
+        int stap_size;          /* STAP-A payload bytes if pending nals were sent now */
+        //last parameter sets seen in stream, published to sdp when they change
+        u8 sps[H264_SPROP_NAL_MAX];
+        int sps_len;
+        u8 pps[H264_SPROP_NAL_MAX];
+        int pps_len;
+        u8 sprop_dirty;
+        //packetization counters
+        u32 nal_cnt;
+        u32 single_cnt;
+        u32 stap_cnt;
+        u32 fu_cnt;
+};
+
+#endif /*_H264_H_*/
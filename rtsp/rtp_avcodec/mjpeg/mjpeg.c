@@ -9,93 +9,178 @@
 #include "sockets.h"
 #include "lwip/netif.h"
 
-#define WRITE_SIZE 1450   
-extern int max_skb_buf_num;               
-extern int skbdata_used_num;
+#define WRITE_SIZE RTP_MTU_SIZE
 
 
-static void parse_jpeg_header(u8 *jpeg_data, int len, int *width, int *height, u8 *type, u16 *dri, u8 *precision, u8 *lqt, u8 *cqt, int *hdr_len){
-	u8 *ptr;
-        u8 *start;
-        if(jpeg_data == NULL)
+#define JPEG_DQT_MAX    4       //DQT segments remembered per frame, baseline allows four tables
+#define JPEG_HASH_BASIS 2166136261u
+
+//fnv-1a over 32 bit words, only tells whether a header segment changed since previous frame
+static u32 jpeg_seg_hash(u32 h, u8 *p, int len)
+{
+        u32 w;
+        h = (h ^ (u32)len) * 16777619u;
+        while(len >= 4)
         {
-            printf("\n\rnull jpeg data!\n\r");
+            memcpy(&w, p, 4);
+            h = (h ^ w) * 16777619u;
+            p += 4;
+            len -= 4;
+        }
+        while(len-- > 0)
+            h = (h ^ *p++) * 16777619u;
+        return h;
+}
+
+//copy every table of a DQT segment, one segment may carry luma and chroma tables back to back
+static void jpeg_parse_dqt(struct rtp_jpeg_obj *jpeg_obj, u8 *seg, int len)
+{
+        int tbl_len;
+        u8 id;
+        while(len > 0)
+        {
+            jpeg_obj->cache.precision = seg[0] >> 4;
+            id = seg[0] & 0x0f;
+            tbl_len = (jpeg_obj->cache.precision != 0) ? 128 : 64;
+            if(len < 1 + tbl_len)
+                return;
+            memcpy((id == 0) ? jpeg_obj->lqt : jpeg_obj->cqt, seg + 1, tbl_len);
+            seg += 1 + tbl_len;
+            len -= 1 + tbl_len;
+        }
+}
+
+//frame size and rtp type from SOF0, sampling of first component tells 4:2:2 from 4:2:0
+static void jpeg_parse_sof(struct jpeg_hdr_cache *cache, u8 *seg, int len)
+{
+        cache->width = cache->height = 0;
+        cache->type = 0;
+        if(len < 6)
             return;
+        cache->height = seg[1] << 8 | seg[2];
+        cache->width = seg[3] << 8 | seg[4];
+        if(seg[5] == 3 && len >= 6 + 3 * 3)
+        {
+            if(seg[7] == 0x21)
+                cache->type = 0;
+            else if(seg[7] == 0x22)
+                cache->type = 1;
         }
-	ptr = start = jpeg_data;
-        u8 i;
-        u16 rec; //header length record
+}
+
+//compare header segments of frame against the ones of previous frame and reparse only what changed
+static void jpeg_update_cache(struct rtp_jpeg_obj *jpeg_obj, u8 **dqt, int *dqt_len, int dqt_nb, u8 *sof, int sof_len, u8 *dri)
+{
+        struct jpeg_hdr_cache *cache = &jpeg_obj->cache;
+        u32 hash = JPEG_HASH_BASIS;
+        int i;
 
-        while((ptr - start) < len)
+        cache->changed = 0;
+        for(i = 0; i < dqt_nb; i++)
+            hash = jpeg_seg_hash(hash, dqt[i], dqt_len[i]);
+        if(hash != cache->dqt_hash)
         {
-          if(*ptr == 0xff)
-          {
-              switch(*(ptr + 1))
-              {              
-                case(0xdb):     //parse quantization table
-                  ptr += 4;
-                  *precision = (*ptr)>>4;
-                  i = (*ptr)&(0x0f);
-                  ptr ++;
-                  if(*precision != 0) //16 bit precision
-                  {
-                      if(i == 0)
-                          memcpy(lqt, ptr, 128);
-                      else
-                          memcpy(cqt, ptr, 128);
-                      ptr +=128;
-                  }else{              //8 bit precision  
-                      if(i == 0)
-                          memcpy(lqt, ptr, 64);
-                      else
-                          memcpy(cqt, ptr, 64);
-                      ptr +=64;
-                  }
-                  break;                
-                case(0xc4):     //parse DHT - skip here
-                  ptr += 2;
-                  rec = (*ptr << 8) | *(ptr + 1);
-                  ptr += rec;
-                  break;                
-                case(0xc0):     //parse SOF0
-                  ptr += 5;
-                  *height = *ptr << 8 | *(ptr + 1);
-                  ptr += 2;
-                  *width = *ptr << 8 | *(ptr + 1);
-                  ptr += 2;
-                  if(*ptr == 3) //parse component
+            cache->dqt_hash = hash;
+            cache->changed |= JPEG_SEG_DQT;
+            for(i = 0; i < dqt_nb; i++)
+                jpeg_parse_dqt(jpeg_obj, dqt[i], dqt_len[i]);
+        }
+        hash = (sof != NULL) ? jpeg_seg_hash(JPEG_HASH_BASIS, sof, sof_len) : 0;
+        if(hash != cache->sof_hash)
+        {
+            cache->sof_hash = hash;
+            cache->changed |= JPEG_SEG_SOF;
+            jpeg_parse_sof(cache, sof, (sof != NULL) ? sof_len : 0);
+        }
+        hash = (dri != NULL) ? jpeg_seg_hash(JPEG_HASH_BASIS, dri, 2) : 0;
+        if(hash != cache->dri_hash)
+        {
+            cache->dri_hash = hash;
+            cache->changed |= JPEG_SEG_DRI;
+            cache->dri = (dri != NULL) ? (dri[0] << 8 | dri[1]) : 0;
+        }
+        if(cache->changed)
+            cache->miss_cnt++;
+        else
+            cache->hit_cnt++;
+}
+
+//walk header segments by their length up to SOS, set hdr_len to first byte of scan data
+static int parse_jpeg_header(struct rtp_jpeg_obj *jpeg_obj, u8 *jpeg_data, int len)
+{
+        u8 *ptr, *end, *seg;
+        u8 *dqt[JPEG_DQT_MAX];
+        int dqt_len[JPEG_DQT_MAX];
+        int dqt_nb = 0;
+        u8 *sof = NULL, *dri = NULL;
+        int sof_len = 0;
+        int seg_len;
+        u8 m;
+
+        if(jpeg_data == NULL)
+        {
+            printf("\n\rnull jpeg data!\n\r");
+            return -EINVAL;
+        }
+        ptr = jpeg_data;
+        end = jpeg_data + len;
+        while(ptr + 1 < end)
+        {
+            //nothing but markers is expected before SOS, skip stray bytes to next 0xff
+            if(*ptr != 0xff)
+            {
+                if((ptr = memchr(ptr, 0xff, end - ptr)) == NULL)
+                    break;
+                continue;
+            }
+            m = ptr[1];
+            //fill byte
+            if(m == 0xff)
+            {
+                ptr++;
+                continue;
+            }
+            //stand-alone markers carry no length
+            if(m == JPEG_M_SOI || m == JPEG_M_TEM || (m >= JPEG_M_RST0 && m <= JPEG_M_RST7))
+            {
+                ptr += 2;
+                continue;
+            }
+            if(m == JPEG_M_EOI || ptr + 4 > end)
+                break;
+            seg_len = (ptr[2] << 8) | ptr[3];
+            if(seg_len < 2 || ptr + 2 + seg_len > end)
+                break;
+            seg = ptr + 4;
+            seg_len -= 2;
+            switch(m)
+            {
+                case(JPEG_M_DQT):
+                  if(dqt_nb < JPEG_DQT_MAX)
                   {
-                      ptr++;
-                      if(*(ptr+1) == 0x21)
-                        *type = 0;
-                      else if(*(ptr+1) == 0x22)
-                        *type = 1;
-                      ptr += 9;
+                      dqt[dqt_nb] = seg;
+                      dqt_len[dqt_nb++] = seg_len;
                   }
                   break;
-                case(0xc1):     //parse SOF1 - skip here
-                  ptr++;
+                case(JPEG_M_SOF0):
+                  sof = seg;
+                  sof_len = seg_len;
                   break;
-                case(0xdd):     //parse dri
-                  ptr += 4;
-                  *dri = *ptr << 8 | *(ptr + 1);
-                  ptr += 2;
+                case(JPEG_M_DRI):
+                  if(seg_len >= 2)
+                      dri = seg;
                   break;
-                /*end of parsing condition*/
-                case(0xda):     //parse SOS and return
-                  ptr += 2;
-                  rec = (*ptr << 8) | *(ptr + 1);
-                  ptr += rec;
-                  *hdr_len = ptr - start;
-                case(0xd9):
-                  return;
-                default:
-                  ptr++;
-              }
-          }else{
-              ptr++;
-          }
+                case(JPEG_M_SOS):
+                  jpeg_obj->hdr_len = seg + seg_len - jpeg_data;
+                  jpeg_update_cache(jpeg_obj, dqt, dqt_len, dqt_nb, sof, sof_len, dri);
+                  return 0;
+                default:        //DHT, APPn, COM and others are skipped
+                  break;
+            }
+            ptr = seg + seg_len;
         }
+        jpeg_obj->cache.bad_cnt++;
+        return -EINVAL;
 }
 
 static void fillJpegHeader(struct jpeghdr *jpghdr, u8 type, u8 typespec, int width, int height, u16 dri, u8 q)
@@ -111,9 +196,9 @@ static void fillRstHeader(struct jpeghdr_rst *rsthdr, u16 dri)
 {
         rsthdr->dri = htons(dri);
 	if (dri != 0) {
-            rsthdr->f = 1;        /* This code does not align RIs */
+            rsthdr->f = 1;        /* template says unaligned, aligned packets patch f/l/count */
             rsthdr->l = 1;
-            rsthdr->count = 0x3fff;
+            rsthdr->count = RTP_JPEG_RST_UNALIGNED;
         }
 }
 
@@ -156,56 +241,32 @@ void mjpeg_hdl_extra_deinit(void *ctx)
         pckt->extra = NULL;
 }
 
-int mjpeg_hdl_send(void *ctx)
+static int mjpeg_qtable_len(u8 precision)
+{
+        return (precision != 0) ? 128 : 64;
+}
+
+//build rtp, jpeg and restart headers plus quantization tables once, packets only patch offset and marker
+static void mjpeg_build_tmpl(rtp_sink_t *sink, struct rtp_jpeg_obj *jpeg_obj)
 {
-	rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
-        rtp_sink_t *sink = subsession->sink;
         struct rtp_packet *pckt = sink->packet;
-        struct rtp_jpeg_obj *jpeg_obj = (struct rtp_jpeg_obj *)pckt->extra;
-        rtp_hdr_t *rtphdr;
+        struct jpeg_hdr_cache *cache = &jpeg_obj->cache;
         struct jpeghdr *jpghdr;
-        int i, ret;
-        u8 type, precision;
-        u16 dri;
-        int rtp_width, rtp_height;
-        u8 buf[WRITE_SIZE];
-        u8 *ptr, *tmp, *data_entry;
-        int bytes_left, retry_cnt;
-        int header_len, dqt_len, data_len, offset;
-        
-        int socket = sink->rtp_sock;
-        struct sockaddr_in adr_cs;
-        int len_cs = sizeof(adr_cs);
-        adr_cs.sin_family = AF_INET;
-        adr_cs.sin_addr.s_addr = *(uint32_t *)subsession->client.client_ip;
-        adr_cs.sin_port = htons(subsession->client.transport.client_port_even);
-        
-        type = precision = dri = 0;
-        rtp_width = rtp_height = 0;
-        header_len = dqt_len = data_len = offset = 0;
-
-        parse_jpeg_header(pckt->data, pckt->len, &rtp_width, &rtp_height, &type, &dri, &precision, jpeg_obj->lqt, jpeg_obj->cqt, &jpeg_obj->hdr_len);
-        data_entry = pckt->data;
+        u8 *ptr = jpeg_obj->tmpl;
+        int tbl_len = mjpeg_qtable_len(cache->precision);
 
-        rtp_fill_header(&pckt->rtphdr, 2, 0, 0, 0, 0, sink->pt, sink->seq_no, sink->now_ts, sink->ssrc);
-        fillJpegHeader(&jpeg_obj->jpghdr, type, /*typespec*/0, rtp_width, rtp_height, dri, /*q*/USE_EXPLICIT_DQT);
-        fillRstHeader(&jpeg_obj->rsthdr, dri);
-        fillqtable(&jpeg_obj->qtable, precision);
+        rtp_fill_header(&pckt->rtphdr, 2, 0, 0, 0, 0, sink->pt, 0, 0, 0);
+        fillJpegHeader(&jpeg_obj->jpghdr, cache->type, /*typespec*/0, cache->width, cache->height, cache->dri, /*q*/USE_EXPLICIT_DQT);
+        fillRstHeader(&jpeg_obj->rsthdr, cache->dri);
+        fillqtable(&jpeg_obj->qtable, cache->precision);
         //dumpJpegHeader(&jpeg_obj->jpghdr);
-        //send packet
-        bytes_left = pckt->len;
-        ptr = buf;
         //ignore rtp header cc check since we only allow single source
         memcpy(ptr, &pckt->rtphdr, RTP_HDR_SZ);
-        rtphdr = (rtp_hdr_t *)ptr;
         ptr += RTP_HDR_SZ;
-        
         memcpy(ptr, &jpeg_obj->jpghdr, sizeof(jpeg_obj->jpghdr));
         jpghdr = (struct jpeghdr *)ptr;
         ptr += sizeof(jpeg_obj->jpghdr);
-        
-        if(jpeg_obj->frame_offset == 0)
-            jpghdr->off = 0;
+        jpghdr->off = 0;
         if(jpeg_obj->rsthdr.dri > 0)
         {
             memcpy(ptr, &jpeg_obj->rsthdr, sizeof(jpeg_obj->rsthdr));
@@ -214,75 +275,166 @@ int mjpeg_hdl_send(void *ctx)
             //to fix logitech c160 no dri bug
             jpghdr->q = 0;
         }
-        header_len = ptr - buf;
-        //printf("entering frame sending loop\n\r");
-        while(bytes_left > 0){
-            if(offset == 0)
+        jpeg_obj->tmpl_main_len = ptr - jpeg_obj->tmpl;
+        if(jpghdr->q >= 128)
+        {
+            memcpy(ptr, &jpeg_obj->qtable, sizeof(jpeg_obj->qtable));
+            ptr += sizeof(jpeg_obj->qtable);
+            memcpy(ptr, jpeg_obj->lqt, tbl_len);
+            ptr += tbl_len;
+            memcpy(ptr, jpeg_obj->cqt, tbl_len);
+            ptr += tbl_len;
+        }
+        jpeg_obj->tmpl_len = ptr - jpeg_obj->tmpl;
+}
+
+//queue one packet of frame data at frame_offset, return its header in arena for further patching
+static u8 *mjpeg_add_frag(struct rtp_frag_list *list, struct rtp_jpeg_obj *jpeg_obj, int header_len, u8 *data, int data_len, int last)
+{
+        u8 *hdr;
+        if(rtp_frag_list_add(list, jpeg_obj->tmpl, header_len, data, data_len) < 0)
+            return NULL;
+        hdr = rtp_frag_hdr(list, list->frag_cnt - 1);
+        //24 bit fragment offset in network order right after rtp header type-specific byte
+        hdr[RTP_HDR_SZ + 1] = (u8)(jpeg_obj->frame_offset >> 16);
+        hdr[RTP_HDR_SZ + 2] = (u8)(jpeg_obj->frame_offset >> 8);
+        hdr[RTP_HDR_SZ + 3] = (u8)jpeg_obj->frame_offset;
+        if(last)
+            hdr[1] |= 0x80; //marker on last packet of frame
+        jpeg_obj->frame_offset += data_len;
+        return hdr;
+}
+
+//restart header sits after rtp and main jpeg headers, bits written by hand since bitfield order is up to compiler
+static void mjpeg_patch_rst(u8 *hdr, u8 f, u8 l, u16 count)
+{
+        hdr += RTP_HDR_SZ + sizeof(struct jpeghdr) + 2;
+        hdr[0] = (f << 7) | (l << 6) | ((count >> 8) & 0x3f);
+        hdr[1] = (u8)count;
+}
+
+//offset right after the next RSTn marker at or beyond from, len if scan has none left
+static int jpeg_next_rst(u8 *data, int from, int len)
+{
+        u8 *ptr = data + from, *end = data + len;
+        while(ptr + 1 < end && (ptr = memchr(ptr, 0xff, end - ptr - 1)) != NULL)
+        {
+            if(ptr[1] >= JPEG_M_RST0 && ptr[1] <= JPEG_M_RST7)
+                return ptr + 2 - data;
+            //stuffed 0xff00 or fill byte
+            ptr++;
+        }
+        return len;
+}
+
+/*
+ * Restart interval aligned packetizing, rfc 2435 3.1.7. A packet carries
+ * whole intervals with F and L set and count of its first interval, an
+ * interval larger than a packet is split with F on its first and L on its
+ * last piece. Interval boundaries are found by scanning for RSTn markers.
+ */
+static int mjpeg_packetize_rst(struct rtp_frag_list *list, struct rtp_jpeg_obj *jpeg_obj, int header_len, u8 *data, int len)
+{
+        int pos = 0, end, room;
+        int ri = 0, ri_start = 0, count;
+        int ri_end = jpeg_next_rst(data, 0, len);
+        u8 f, *hdr;
+
+        while(pos < len)
+        {
+            room = WRITE_SIZE - header_len;
+            f = (pos == ri_start);
+            if(ri_end - pos > room)
             {
-                if(jpghdr->q >= 128)
-                {
-                    tmp = ptr;
-                    memcpy(tmp, &jpeg_obj->qtable, sizeof(jpeg_obj->qtable));
-                    tmp += sizeof(jpeg_obj->qtable);
-                    if(jpeg_obj->qtable.precision != 0)
-                    {
-                        memcpy(tmp, jpeg_obj->lqt, 128);
-                        tmp += 128;
-                        memcpy(tmp, jpeg_obj->cqt, 128);
-                        tmp += 128;
-                    }else{
-                        memcpy(tmp, jpeg_obj->lqt, 64);
-                        tmp += 64;
-                        memcpy(tmp, jpeg_obj->cqt, 64);
-                        tmp += 64;                    
-                    }
-                    dqt_len = tmp - ptr;
-                    header_len += (tmp - ptr);
-                    data_entry += jpeg_obj->hdr_len;
-                    bytes_left -= jpeg_obj->hdr_len;
-                }else{
-                    
-                    dqt_len = 0;
-                }
+                //interval does not fit, send a piece of it
+                if(f)
+                    jpeg_obj->cache.rst_split_cnt++;
+                if((hdr = mjpeg_add_frag(list, jpeg_obj, header_len, data + pos, room, 0)) == NULL)
+                    return -ENOMEM;
+                mjpeg_patch_rst(hdr, f, 0, ri % RTP_JPEG_RST_UNALIGNED);
+                pos += room;
             }else{
-                header_len = ptr - buf;
-                dqt_len = 0;
+                //rest of interval, then as many whole intervals as fit if packet started at a boundary
+                count = ri;
+                do{
+                    end = ri_end;
+                    ri++;
+                    ri_start = ri_end;
+                    ri_end = jpeg_next_rst(data, ri_start, len);
+                }while(f && ri_start < len && ri_end - pos <= room);
+                if((hdr = mjpeg_add_frag(list, jpeg_obj, header_len, data + pos, end - pos, end == len)) == NULL)
+                    return -ENOMEM;
+                mjpeg_patch_rst(hdr, f, 1, count % RTP_JPEG_RST_UNALIGNED);
+                pos = end;
             }
+            header_len = jpeg_obj->tmpl_main_len;
+        }
+        return 0;
+}
+
+//cut current frame into the shared fragment list of sink, destination fields are left for fan-out
+static int mjpeg_packetize(rtp_sink_t *sink)
+{
+        struct rtp_packet *pckt = sink->packet;
+        struct rtp_jpeg_obj *jpeg_obj = (struct rtp_jpeg_obj *)pckt->extra;
+        struct rtp_frag_list *list = &sink->frags;
+        u8 *data_entry;
+        int bytes_left;
+        int header_len, data_len, offset;
+        
+        data_len = offset = 0;
+        jpeg_obj->frame_offset = 0;
+        data_entry = pckt->data;
+        bytes_left = pckt->len;
+        rtp_frag_list_reset(list, pckt->ts);
+        //template is still valid while DQT, SOF and DRI of stream stay the same
+        if(jpeg_obj->tmpl_len == 0 || jpeg_obj->cache.changed)
+            mjpeg_build_tmpl(sink, jpeg_obj);
+        //tables travel in the first packet, so jpeg headers of frame are not sent
+        header_len = jpeg_obj->tmpl_len;
+        if(jpeg_obj->tmpl_len > jpeg_obj->tmpl_main_len)
+        {
+            data_entry += jpeg_obj->hdr_len;
+            bytes_left -= jpeg_obj->hdr_len;
+        }
+#if MJPEG_RST_ALIGN
+        if(jpeg_obj->cache.dri != 0)
+            return mjpeg_packetize_rst(list, jpeg_obj, header_len, data_entry, bytes_left);
+#endif
+        while(bytes_left > 0){
             data_len = WRITE_SIZE - header_len;
-            if(data_len >= bytes_left)
-            {
+            if(data_len > bytes_left)
                 data_len = bytes_left;
-                rtphdr->m = 1;
-            }
-            memcpy(ptr + dqt_len, data_entry + offset, data_len);
-check_skb:
-            if(skbdata_used_num > (max_skb_buf_num - 3)){
-                rtw_msleep_os(1);
-                goto check_skb;
-            }else{
-                retry_cnt = 3;
-                if(sendto(socket, buf, header_len + data_len, 0, (struct sockaddr *)&adr_cs, len_cs) < 0)
-                {
-                  do{
-                      rtw_msleep_os(1);
-                      sendto(socket, buf, header_len + data_len, 0, (struct sockaddr *)&adr_cs, len_cs);
-                      retry_cnt--;
-                  }while(ret < 0 && retry_cnt > 0);
-                  if(ret < 0)
-                      return -EAGAIN;
-                }
-            }
+            if(mjpeg_add_frag(list, jpeg_obj, header_len, data_entry + offset, data_len, data_len == bytes_left) == NULL)
+                return -ENOMEM;
             offset += data_len;
-            jpeg_obj->frame_offset += data_len;
-            jpghdr->off = ((jpeg_obj->frame_offset & 0xff) << 16 | (jpeg_obj->frame_offset & 0xff00) | (jpeg_obj->frame_offset & 0xff0000UL) >> 16);
             bytes_left -= data_len;
-            sink->seq_no++; 
-            rtphdr->seq = htons(sink->seq_no);
-            sink->octet_cnt += (header_len + data_len);
+            header_len = jpeg_obj->tmpl_main_len;
         }
+        return 0;
+}
+
+int mjpeg_hdl_send(void *ctx)
+{
+	rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        rtp_sink_t *sink = subsession->sink;
+        struct rtp_packet *pckt = sink->packet;
+        struct rtp_jpeg_obj *jpeg_obj = (struct rtp_jpeg_obj *)pckt->extra;
+        int ret;
+
+        if(parse_jpeg_header(jpeg_obj, pckt->data, pckt->len) < 0)
+        {
+            MJPEG_ERROR("no scan header in frame, dropped");
+            return -EINVAL;
+        }
+        //packetize once, then every viewer gets the same packets
+        ret = mjpeg_packetize(sink);
+        if(ret < 0)
+            return ret;
+        ret = rtsp_sm_subsession_fanout(subsession, &sink->frags);
         sink->packet_cnt++;
         
-        return 0;
+        return ret;
 }
 
 int mjpeg_hdl_recv(void *ctx)
@@ -6,6 +6,8 @@
 #include "osdep_service.h"
 
 #define MJPEG_DEBUG 0
+//pack whole restart intervals per packet (rfc 2435 3.1.7) when stream has DRI, a lost packet then costs only its intervals
+#define MJPEG_RST_ALIGN 1
 
 #if MJPEG_DEBUG
 #define MJPEG_PRINTF(fmt, args...)    printf("\n\r%s: " fmt, __FUNCTION__, ## args)
@@ -38,10 +40,46 @@ struct jpeghdr_qtable {
         u16 length;
 };
 
+/* jpeg markers, second byte after 0xff */
+#define JPEG_M_SOF0             0xc0
+#define JPEG_M_DHT              0xc4
+#define JPEG_M_RST0             0xd0
+#define JPEG_M_RST7             0xd7
+#define JPEG_M_SOI              0xd8
+#define JPEG_M_EOI              0xd9
+#define JPEG_M_SOS              0xda
+#define JPEG_M_DQT              0xdb
+#define JPEG_M_DRI              0xdd
+#define JPEG_M_TEM              0x01
+
+/* header segments cached per stream, bit set when segment differs from previous frame */
+#define JPEG_SEG_DQT            0x01
+#define JPEG_SEG_SOF            0x02
+#define JPEG_SEG_DRI            0x04
+
 #define RTP_JPEG_RESTART        0x40
+#define RTP_JPEG_RST_UNALIGNED  0x3fff  /* restart count when packets are not aligned to intervals */
 #define USE_EXPLICIT_DQT        255
 #define USE_IMPLICIT_DQT        0
 
+//stream parameters taken from DQT, SOF and DRI, reparsed only when segment hash changes
+struct jpeg_hdr_cache
+{
+        u32 dqt_hash;
+        u32 sof_hash;
+        u32 dri_hash;
+        int width;
+        int height;
+        u8 type;
+        u8 precision;
+        u16 dri;
+        u8 changed;             /* JPEG_SEG_* changed by last frame */
+        u32 rst_split_cnt;      /* restart intervals too large for one packet */
+        u32 hit_cnt;            /* frames that reused every cached segment */
+        u32 miss_cnt;
+        u32 bad_cnt;            /* frames without SOS in bounds */
+};
+
 struct rtp_jpeg_obj
 {
         struct jpeghdr jpghdr;
@@ -51,6 +89,11 @@ struct rtp_jpeg_obj
         u8     cqt[64*2];          /* Croma Quantizer table              */
         int hdr_len;
         int frame_offset;
+        struct jpeg_hdr_cache cache;
+        //header template, rebuilt only when stream parameters change
+        u8     tmpl[RTP_HDR_SZ + sizeof(struct jpeghdr) + sizeof(struct jpeghdr_rst) + sizeof(struct jpeghdr_qtable) + 64*2*2];
+        int tmpl_len;           /* first packet: rtp + jpeg + rst + qtable headers and tables */
+        int tmpl_main_len;      /* other packets: rtp + jpeg + rst headers */
 };
 
 /*for debug purpose*/
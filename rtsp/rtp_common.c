@@ -1,4 +1,6 @@
+#include "platform/platform_stdlib.h"
 #include "rtp_common.h"
+#include "rtsp_rtp_dbg.h"
 
 void rtp_fill_header(rtp_hdr_t *rtphdr, int version, int padding, int extension, int cc, int marker, int pt, u16 seq, u32 ts, u32 ssrc)
 {
@@ -91,4 +93,253 @@ int rtp_parse_header(u8 *src, rtp_hdr_t *rtphdr, int is_nbo)
           //to do parse csrc
         }
         return offset;
-}
\ No newline at end of file
+}
+
+//patch seq, timestamp and ssrc of a network order rtp header in place
+void rtp_patch_header(u8 *hdr, u16 seq, u32 ts, u32 ssrc)
+{
+        hdr[2] = (u8)(seq >> 8);
+        hdr[3] = (u8)seq;
+        hdr[4] = (u8)(ts >> 24);
+        hdr[5] = (u8)(ts >> 16);
+        hdr[6] = (u8)(ts >> 8);
+        hdr[7] = (u8)ts;
+        hdr[8] = (u8)(ssrc >> 24);
+        hdr[9] = (u8)(ssrc >> 16);
+        hdr[10] = (u8)(ssrc >> 8);
+        hdr[11] = (u8)ssrc;
+}
+
+int rtp_frag_list_init(struct rtp_frag_list *list, int frag_max, int arena_size)
+{
+        memset(list, 0, sizeof(struct rtp_frag_list));
+        list->frag = malloc(frag_max * sizeof(struct rtp_frag));
+        list->hdr_arena = malloc(arena_size);
+        if(list->frag == NULL || list->hdr_arena == NULL)
+        {
+            RTP_ERROR("allocate fragment list failed");
+            rtp_frag_list_free(list);
+            return -ENOMEM;
+        }
+        list->frag_max = frag_max;
+        list->arena_size = arena_size;
+        return 0;
+}
+
+void rtp_frag_list_free(struct rtp_frag_list *list)
+{
+        if(list->frag != NULL)
+            free(list->frag);
+        if(list->hdr_arena != NULL)
+            free(list->hdr_arena);
+        memset(list, 0, sizeof(struct rtp_frag_list));
+}
+
+void rtp_frag_list_reset(struct rtp_frag_list *list, u32 ts)
+{
+        list->frag_cnt = 0;
+        list->arena_used = 0;
+        list->ts = ts;
+}
+
+void rtp_frag_list_set_flush(struct rtp_frag_list *list, int (*flush)(void *ctx, struct rtp_frag_list *list), void *ctx)
+{
+        list->flush = flush;
+        list->flush_ctx = ctx;
+}
+
+//append one packet, headers are copied into arena while payload is kept by reference
+int rtp_frag_list_add(struct rtp_frag_list *list, u8 *hdr, int hdr_len, u8 *payload, int payload_len)
+{
+        struct rtp_frag *frag;
+        if(list->frag_cnt >= list->frag_max || list->arena_used + hdr_len > list->arena_size)
+        {
+            if(list->flush == NULL || list->frag_cnt == 0)
+            {
+                RTP_WARN("fragment list full");
+                return -ENOMEM;
+            }
+            //send queued packets and go on with an empty list of same timestamp, codecs only patch the packet just added
+            //so nothing flushed is touched again, a failed send to some viewer is reported by the final fan-out
+            list->flush_cnt++;
+            list->flush(list->flush_ctx, list);
+            list->frag_cnt = 0;
+            list->arena_used = 0;
+        }
+        frag = &list->frag[list->frag_cnt++];
+        frag->hdr_off = list->arena_used;
+        frag->hdr_len = hdr_len;
+        frag->payload = payload;
+        frag->payload_len = payload_len;
+        frag->ts_delta = 0;
+        memcpy(list->hdr_arena + list->arena_used, hdr, hdr_len);
+        list->arena_used += hdr_len;
+        return 0;
+}
+//pointer to arena header bytes of fragment idx, codecs patch per packet fields through it
+u8 *rtp_frag_hdr(struct rtp_frag_list *list, int idx)
+{
+        return list->hdr_arena + list->frag[idx].hdr_off;
+}
+
+int rtp_buf_pool_init(struct rtp_buf_pool *pool, int buf_size, int buf_nb)
+{
+        int i;
+        memset(pool, 0, sizeof(struct rtp_buf_pool));
+        //keep every buffer aligned for the free list pointer
+        buf_size = (buf_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        pool->mem = malloc(buf_size * buf_nb);
+        if(pool->mem == NULL)
+        {
+            RTP_ERROR("allocate buffer pool failed");
+            return -ENOMEM;
+        }
+        pool->buf_size = buf_size;
+        pool->buf_nb = buf_nb;
+        for(i = buf_nb - 1; i >= 0; i--)
+            rtp_buf_put(pool, pool->mem + i * buf_size);
+        return 0;
+}
+
+void rtp_buf_pool_free(struct rtp_buf_pool *pool)
+{
+        if(pool->mem != NULL)
+            free(pool->mem);
+        memset(pool, 0, sizeof(struct rtp_buf_pool));
+}
+
+u8 *rtp_buf_get(struct rtp_buf_pool *pool)
+{
+        void *buf = pool->free_head;
+        if(buf == NULL)
+        {
+            pool->empty_cnt++;
+            return NULL;
+        }
+        pool->free_head = *(void **)buf;
+        pool->free_nb--;
+        return (u8 *)buf;
+}
+
+void rtp_buf_put(struct rtp_buf_pool *pool, u8 *buf)
+{
+        if(buf == NULL)
+            return;
+        *(void **)buf = pool->free_head;
+        pool->free_head = buf;
+        pool->free_nb++;
+}
+
+#if defined(__GNUC__)
+#define PORT_CAS(ptr, old, new)	__sync_bool_compare_and_swap((ptr), (old), (new))
+#define PORT_CTZ(x)		__builtin_ctz(x)
+#else
+#define PORT_CAS(ptr, old, new)	rtp_port_cas((ptr), (old), (new))
+#define PORT_CTZ(x)		rtp_port_ctz(x)
+static int rtp_port_cas(volatile u32 *ptr, u32 old, u32 new)
+{
+        int ret = 0;
+        rtw_enter_critical(NULL, NULL);
+        if(*ptr == old)
+        {
+                *ptr = new;
+                ret = 1;
+        }
+        rtw_exit_critical(NULL, NULL);
+        return ret;
+}
+
+static int rtp_port_ctz(u32 x)
+{
+        int n = 0;
+        while(!(x & 1))
+        {
+                x >>= 1;
+                n++;
+        }
+        return n;
+}
+#endif
+
+int rtp_port_range_init(struct rtp_port_range *r, int base, int range)
+{
+        int pair_nb, i;
+        memset((void *)r, 0, sizeof(struct rtp_port_range));
+        base = (base + 1) & ~1;
+        pair_nb = range / 2;
+        if(pair_nb <= 0 || base + 2 * pair_nb > 0x10000)
+            return -EINVAL;
+        if(pair_nb > RTP_PORT_PAIR_MAX)
+        {
+            RTP_WARN("range %d cut to %d pairs", range, RTP_PORT_PAIR_MAX);
+            pair_nb = RTP_PORT_PAIR_MAX;
+        }
+        r->base = base;
+        r->pair_nb = pair_nb;
+        r->word_nb = (pair_nb + 31) / 32;
+        //bits past the last pair stay set so they are never handed out
+        for(i = pair_nb; i < r->word_nb * 32; i++)
+            r->map[i / 32] |= (u32)1 << (i % 32);
+        ATOMIC_SET(&r->in_use, 0);
+        return 0;
+}
+
+//claim a free pair, return its even port or -ENOMEM if range is exhausted
+int rtp_port_pair_get(struct rtp_port_range *r)
+{
+        int n, idx, bit, in_use;
+        u32 word;
+        for(n = 0; n < r->word_nb; n++)
+        {
+            idx = (r->hint + n) % r->word_nb;
+            while((word = r->map[idx]) != 0xffffffff)
+            {
+                bit = PORT_CTZ(~word);
+                if(!PORT_CAS(&r->map[idx], word, word | ((u32)1 << bit)))
+                    continue; //lost race, rescan this word
+                r->hint = idx;
+                r->get_cnt++;
+                in_use = ATOMIC_INC_RETURN(&r->in_use);
+                if(in_use > r->peak)
+                    r->peak = in_use;
+                return r->base + 2 * (idx * 32 + bit);
+            }
+        }
+        r->fail_cnt++;
+        return -ENOMEM;
+}
+
+//release pair by its even (or odd) port, releasing twice is counted and ignored
+void rtp_port_pair_put(struct rtp_port_range *r, int port)
+{
+        int pair = (port - r->base) / 2;
+        int idx = pair / 32;
+        u32 mask = (u32)1 << (pair % 32);
+        u32 word;
+        if(port < r->base || pair >= r->pair_nb)
+        {
+            r->bad_put_cnt++;
+            RTP_WARN("port %d not in range", port);
+            return;
+        }
+        do {
+            word = r->map[idx];
+            if(!(word & mask))
+            {
+                r->bad_put_cnt++;
+                RTP_WARN("port %d was not allocated", port);
+                return;
+            }
+        }while(!PORT_CAS(&r->map[idx], word, word & ~mask));
+        r->put_cnt++;
+        ATOMIC_DEC(&r->in_use);
+        //freed early words get reused first, keeps ports compact
+        if(idx < r->hint)
+            r->hint = idx;
+}
+
+void rtp_port_range_dump(struct rtp_port_range *r, const char *name)
+{
+        RTP_INFO("%s ports %d-%d: in use %d peak %d get %d put %d fail %d bad put %d", name, r->base, r->base + 2 * r->pair_nb - 1,
+                 ATOMIC_READ(&r->in_use), r->peak, r->get_cnt, r->put_cnt, r->fail_cnt, r->bad_put_cnt);
+}
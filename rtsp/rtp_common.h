@@ -23,6 +23,12 @@
 #define RTP_PORT_RANGE 1000
 #define RTP_CLIENT_PORT_BASE 51020
 #define RTP_CLIENT_PORT_RANGE 1000
+#define RTP_PORT_PAIR_MAX	512	//largest range a port allocator covers, in even/odd pairs
+
+#define RTP_MTU_SIZE		1450	//rtp header + payload headers + payload
+#define RTP_FRAG_MAX_NB		256	//packets queued per fan-out, larger frames go out in chunks
+#define RTP_FRAG_HDR_MAX	(RTP_HDR_SZ + 8 + 4 + 4 + 256) //rtp + largest payload specific header
+#define RTP_FRAG_ARENA_SIZE	(RTP_FRAG_MAX_NB * 32)
 
 /*define rtp packet status*/
 #define RTP_PCKT_IDLE           0x00 
@@ -92,10 +98,76 @@ struct rtp_packet
 	int index; //internal buffer index if we get frame by ref instead of by copy
 	u8 *data; //pointer to sink data by ref
 	int len; //actual data len;
+	u32 ts; //timestamp of frame
 	_mutex lock;
         u8 status;
 };
 
+/*
+ * Packetize-once fragment list: a frame is cut into packets once, the packets
+ * are kept as header bytes in a shared arena plus a payload reference into the
+ * frame, and then sent to every destination. RTP header of each fragment is a
+ * template, seq/ts/ssrc are patched per destination on a header copy.
+ */
+struct rtp_frag
+{
+	u16 hdr_off; //offset of headers in arena, starting with rtp header
+	u16 hdr_len; //rtp header + payload specific headers
+	u8 *payload; //reference into frame data
+	int payload_len;
+	u32 ts_delta; //added to frame timestamp, audio packets of one frame carry different timestamps
+};
+
+struct rtp_frag_list
+{
+	struct rtp_frag *frag;
+	int frag_max;
+	int frag_cnt;
+	u8 *hdr_arena;
+	int arena_size;
+	int arena_used;
+	u32 ts; //frame timestamp before per destination offset
+	//sends a full list so that a frame larger than the list goes out in chunks
+	int (*flush)(void *ctx, struct rtp_frag_list *list);
+	void *flush_ctx;
+	u32 flush_cnt;
+};
+
+/*
+ * Fixed-size buffer pool kept as a free list, sized once at init so that the
+ * send path never mallocs. Not locked, a pool belongs to one rtp task.
+ */
+struct rtp_buf_pool
+{
+	u8 *mem;
+	void *free_head; //next pointer lives in the first bytes of a free buffer
+	int buf_size;
+	int buf_nb;
+	int free_nb;
+	u32 empty_cnt; //get on an exhausted pool
+};
+
+/*
+ * RTP/RTCP port pair allocator over [base, base + range). One bit per even/odd
+ * pair in 32 bit words, claim finds the first zero bit with ctz and sets it
+ * with compare-and-swap, so no lock is taken. Counters help spotting leaks:
+ * in_use should return to 0 once all sessions are gone.
+ */
+struct rtp_port_range
+{
+	volatile u32 map[(RTP_PORT_PAIR_MAX + 31) / 32];
+	int word_nb;
+	u16 base; //even
+	u16 pair_nb;
+	volatile u32 hint; //word to start next search from
+	ATOMIC_T in_use;
+	u32 peak;
+	u32 get_cnt;
+	u32 put_cnt;
+	u32 fail_cnt; //range exhausted
+	u32 bad_put_cnt; //port out of range or not allocated
+};
+
 typedef struct _rtp_trans_stats{
 	u32 ssrc;
 	//from addr?
@@ -122,4 +194,19 @@ typedef struct _rtp_recv_stats{
 
 void rtp_fill_header(rtp_hdr_t *rtphdr, int version, int padding, int extension, int cc, int marker, int pt, u16 seq, u32 ts, u32 ssrc);
 int rtp_parse_header(u8 *src, rtp_hdr_t *rtphdr, int is_nbo);
+void rtp_patch_header(u8 *hdr, u16 seq, u32 ts, u32 ssrc);
+int rtp_frag_list_init(struct rtp_frag_list *list, int frag_max, int arena_size);
+void rtp_frag_list_free(struct rtp_frag_list *list);
+void rtp_frag_list_reset(struct rtp_frag_list *list, u32 ts);
+void rtp_frag_list_set_flush(struct rtp_frag_list *list, int (*flush)(void *ctx, struct rtp_frag_list *list), void *ctx);
+int rtp_frag_list_add(struct rtp_frag_list *list, u8 *hdr, int hdr_len, u8 *payload, int payload_len);
+u8 *rtp_frag_hdr(struct rtp_frag_list *list, int idx);
+int rtp_buf_pool_init(struct rtp_buf_pool *pool, int buf_size, int buf_nb);
+void rtp_buf_pool_free(struct rtp_buf_pool *pool);
+u8 *rtp_buf_get(struct rtp_buf_pool *pool);
+void rtp_buf_put(struct rtp_buf_pool *pool, u8 *buf);
+int rtp_port_range_init(struct rtp_port_range *r, int base, int range);
+int rtp_port_pair_get(struct rtp_port_range *r);
+void rtp_port_pair_put(struct rtp_port_range *r, int port);
+void rtp_port_range_dump(struct rtp_port_range *r, const char *name);
 #endif
\ No newline at end of file
@@ -1,8 +1,61 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE //for sendmmsg
+#endif
 #include "FreeRTOS.h"
 #include "platform/platform_stdlib.h"
 #include "osdep_service.h"
 #include "rtp_sink.h"
 #include "rtsp_rtp_dbg.h"
+#include "sockets.h"
+
+#if !RTP_SINK_SENDMSG
+#pragma message("rtp_sink: no sendmsg, every datagram is assembled in a stack buffer")
+#endif
+
+#if RTP_SINK_BATCH
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103
+#endif
+#define RTP_SINK_GSO_MAX_SIZE	(65535 - 8 - 20) //udp and ip header
+
+struct rtp_sink_batch{
+	int cnt;
+	int len[RTP_SINK_BATCH_MAX];
+	struct sockaddr_in to[RTP_SINK_BATCH_MAX];
+	struct iovec iov[RTP_SINK_BATCH_MAX * 2];
+	struct mmsghdr msg[RTP_SINK_BATCH_MAX];
+	u8 hdr[RTP_SINK_BATCH_MAX][RTP_FRAG_HDR_MAX];
+};
+#endif
+
+#if !defined(__linux__)
+extern int max_skb_buf_num;
+extern int skbdata_used_num;
+#endif
+
+#if defined(__GNUC__)
+#define RING_CAS(ptr, old, new)	__sync_bool_compare_and_swap((ptr), (old), (new))
+#define RING_BARRIER()		__sync_synchronize()
+#else
+#define RING_CAS(ptr, old, new)	rtp_ring_cas((ptr), (old), (new))
+#define RING_BARRIER()
+static int rtp_ring_cas(volatile u32 *ptr, u32 old, u32 new)
+{
+        int ret = 0;
+        rtw_enter_critical(NULL, NULL);
+        if(*ptr == old)
+        {
+                *ptr = new;
+                ret = 1;
+        }
+        rtw_exit_critical(NULL, NULL);
+        return ret;
+}
+#endif
 
 int rtp_sink_init_by_codec_id(rtp_sink_t *sink, u8 codec_id)
 {
@@ -28,7 +81,7 @@ int rtp_sink_init_by_codec_id(rtp_sink_t *sink, u8 codec_id)
 			sink->media_type = AVMEDIA_TYPE_VIDEO;
 			sink->pt = RTP_PT_DYN_BASE;
 			sink->frequency = 90000;
-			//sink->media_hdl_ops = &h264_hdl_ops;
+			sink->media_hdl_ops = &h264_hdl_ops;
 			break;
 		case(AV_CODEC_ID_PCMU):
 			sink->codec_id = codec_id;
@@ -37,7 +90,8 @@ int rtp_sink_init_by_codec_id(rtp_sink_t *sink, u8 codec_id)
 			sink->pt = RTP_PT_PCMU;
 			sink->frequency = 8000;
 			sink->nb_channels = 1;
-			//sink->media_hdl_ops = &g711_hdl_ops;
+			sink->ptime = RTP_PTIME_DEF;
+			sink->media_hdl_ops = &g711_hdl_ops;
 			break;
 		case(AV_CODEC_ID_PCMA):
 			sink->codec_id = codec_id;
@@ -46,7 +100,8 @@ int rtp_sink_init_by_codec_id(rtp_sink_t *sink, u8 codec_id)
 			sink->pt = RTP_PT_PCMA;
 			sink->frequency = 8000;
 			sink->nb_channels = 1;
-			//sink->media_hdl_ops = &g711_hdl_ops;
+			sink->ptime = RTP_PTIME_DEF;
+			sink->media_hdl_ops = &g711_hdl_ops;
 			break;
 		case(AV_CODEC_ID_MP4A_LATM):
 			sink->codec_id = codec_id;
@@ -55,7 +110,7 @@ int rtp_sink_init_by_codec_id(rtp_sink_t *sink, u8 codec_id)
 			sink->pt = RTP_PT_DYN_BASE;
 			sink->frequency = 16000;
 			sink->nb_channels = 2;
-			//sink->media_hdl_ops = &aac_hdl_ops;
+			sink->media_hdl_ops = &aac_hdl_ops;
 			break;
 		case(AV_CODEC_ID_MP4V_ES):
 			sink->codec_id = codec_id;
@@ -117,14 +172,79 @@ void rtp_sink_set_frame_by_none(rtp_sink_t *sink)
         sink->sink_flag &= ~(SINK_FLAG_FRAME_BY_REF | SINK_FLAG_FRAME_BY_BUF);
 }
 
+int rtp_sink_is_pcm_input(rtp_sink_t *sink)
+{
+	return (sink->sink_flag & SINK_FLAG_PCM_INPUT);
+}
+
+//feed 16 bit linear pcm instead of encoded samples, codec must support it
+void rtp_sink_set_pcm_input(rtp_sink_t *sink, int enable)
+{
+	if(enable)
+		sink->sink_flag |= SINK_FLAG_PCM_INPUT;
+	else
+		sink->sink_flag &= ~SINK_FLAG_PCM_INPUT;
+}
+
+//taken by next stream start, sdp has to be refreshed by caller if sink is already published
+int rtp_sink_set_ptime(rtp_sink_t *sink, int ptime)
+{
+	if(ptime != 10 && ptime != 20 && ptime != 40)
+		return -EINVAL;
+	sink->ptime = ptime;
+	return 0;
+}
+
+//queue a frame for the rtp task, ts is taken from last rtp_sink_update_ts
+//with frame by ref, the buffer of index must stay untouched until the frame leaves the ring and is sent
 int rtp_sink_get_frame(rtp_sink_t *sink, int index, u8 *src, int len)
 {
-	struct rtp_packet *pckt = sink->packet;
-        //hook data by reference of external buffer
-        pckt->index = index;
-        pckt->data = src;
-        pckt->len = len;
-        rtp_sink_ind_frame_ready(sink);
+        struct rtp_frame_ring *ring = &sink->ring;
+        struct rtp_frame_desc *desc;
+        u32 head = ring->head;
+        u32 tail, level;
+        int blocked = 0;
+        if(ring->slot == NULL)
+                return -EINVAL;
+        while(1)
+        {
+                tail = ring->tail;
+                if(head - tail < ring->depth)
+                        break;
+                if(ring->policy == RTP_RING_DROP_OLDEST)
+                {
+                        //consumer may pop the same slot concurrently, whoever moves tail first owns it
+                        if(RING_CAS(&ring->tail, tail, tail + 1))
+                                ring->drop_oldest_cnt++;
+                        continue;
+                }
+                if(ring->policy == RTP_RING_BLOCK && !blocked)
+                {
+                        ring->block_cnt++;
+                        blocked = 1;
+                        if(rtp_sink_wait_frame_sent(sink, RTP_RING_BLOCK_TIMEOUT) == 0)
+                                continue;
+                }
+                ring->drop_newest_cnt++;
+                return -EAGAIN;
+        }
+        desc = &ring->slot[head & (ring->depth - 1)];
+        desc->index = index;
+        desc->data = src;
+        desc->len = len;
+        desc->ts = sink->now_ts;
+        //publish descriptor before head
+        RING_BARRIER();
+        ring->head = head + 1;
+        ring->push_cnt++;
+        //tail read above may predate a pop that emptied the ring, sender could be asleep by now
+        RING_BARRIER();
+        level = head + 1 - ring->tail;
+        //sender only sleeps on an empty ring
+        if(level == 1)
+                rtw_up_sema(&ring->ready_sema);
+        if(level > ring->level_max)
+                ring->level_max = level;
 	return 0;
 }
 
@@ -134,6 +254,43 @@ int rtp_sink_update_ts(rtp_sink_t *sink, u32 ts)
 	return 0;
 }
 
+//depth and policy are taken by next rtp_sink_packet_create
+int rtp_sink_set_ring(rtp_sink_t *sink, int depth, u8 policy)
+{
+        u32 n = 1;
+        if(depth <= 0 || depth > RTP_RING_DEPTH_MAX || policy > RTP_RING_BLOCK)
+                return -EINVAL;
+        while(n < depth)
+                n <<= 1;
+        sink->ring.depth = n;
+        sink->ring.policy = policy;
+        return 0;
+}
+
+//number of frames waiting to be sent
+int rtp_sink_ring_level(rtp_sink_t *sink)
+{
+        return (int)(sink->ring.head - sink->ring.tail);
+}
+
+//drop pending frames, consumer side only
+void rtp_sink_ring_flush(rtp_sink_t *sink)
+{
+        struct rtp_frame_ring *ring = &sink->ring;
+        u32 tail;
+        do{
+                tail = ring->tail;
+        }while(!RING_CAS(&ring->tail, tail, ring->head));
+}
+
+void rtp_sink_ring_dump(rtp_sink_t *sink)
+{
+        struct rtp_frame_ring *ring = &sink->ring;
+        RTP_INFO("%s ring depth:%d policy:%d level:%d max:%d push:%d pop:%d drop_oldest:%d drop_newest:%d block:%d", \
+               sink->codec_name, ring->depth, ring->policy, rtp_sink_ring_level(sink), ring->level_max, \
+               ring->push_cnt, ring->pop_cnt, ring->drop_oldest_cnt, ring->drop_newest_cnt, ring->block_cnt);
+}
+
 void rtp_sink_packet_free(rtp_sink_t *sink)
 {
         struct rtp_packet *pckt = sink->packet;
@@ -141,18 +298,43 @@ void rtp_sink_packet_free(rtp_sink_t *sink)
         {
           rtw_mutex_free(&pckt->lock);
           free(pckt);
-          pckt = NULL;
+          sink->packet = NULL;
+        }
+        if(sink->ring.slot != NULL)
+        {
+          rtw_free_sema(&sink->ring.ready_sema);
+          rtw_free_sema(&sink->ring.room_sema);
+          free(sink->ring.slot);
+          sink->ring.slot = NULL;
         }
 }
 
 int rtp_sink_packet_create(rtp_sink_t *sink)
 {
 	struct rtp_packet *pckt = malloc(sizeof(struct rtp_packet));
+        struct rtp_frame_ring *ring = &sink->ring;
 	if(pckt == NULL)
 	{
 		RTP_ERROR("allocate sink packet failed");
 		return -1;
 	}
+        if(ring->depth == 0)
+                rtp_sink_set_ring(sink, RTP_RING_DEPTH_DEF, RTP_RING_DROP_OLDEST);
+        ring->slot = malloc(ring->depth * sizeof(struct rtp_frame_desc));
+        if(ring->slot == NULL)
+        {
+                RTP_ERROR("allocate sink frame ring failed");
+                free(pckt);
+                return -1;
+        }
+        memset(ring->slot, 0, ring->depth * sizeof(struct rtp_frame_desc));
+        ring->head = ring->tail = 0;
+        ring->push_cnt = ring->pop_cnt = 0;
+        ring->drop_oldest_cnt = ring->drop_newest_cnt = ring->block_cnt = 0;
+        ring->level_max = 0;
+        ring->room_wait = 0;
+        rtw_init_sema(&ring->ready_sema, 0);
+        rtw_init_sema(&ring->room_sema, 0);
         memset(pckt, 0, sizeof(struct rtp_packet));
         rtw_mutex_init(&pckt->lock);
 	sink->packet = pckt;
@@ -176,43 +358,418 @@ void rtp_sink_ind_frame_sent(rtp_sink_t *sink)
         //printf("\n\rsent");
 }
 
-void rtp_sink_ind_frame_ready(rtp_sink_t *sink)
-{
-        struct rtp_packet *pckt = sink->packet;
-        rtw_mutex_get(&pckt->lock);
-        pckt->status = RTP_PCKT_READY;
-        rtw_mutex_put(&pckt->lock);        
-        //printf("\n\rready");
-}     
-
-void rtp_sink_ind_frame_process(rtp_sink_t *sink)
+//take the oldest pending frame as current packet, return 0 if a frame was taken
+int rtp_sink_ind_frame_process(rtp_sink_t *sink)
 {
         struct rtp_packet *pckt = sink->packet;
+        struct rtp_frame_ring *ring = &sink->ring;
+        struct rtp_frame_desc desc;
+        u32 tail;
+        do{
+                tail = ring->tail;
+                if(ring->head == tail)
+                        return -EAGAIN;
+                RING_BARRIER();
+                desc = ring->slot[tail & (ring->depth - 1)];
+                //copy is only valid if producer did not drop this slot meanwhile
+        }while(!RING_CAS(&ring->tail, tail, tail + 1));
+        ring->pop_cnt++;
+        //only a producer already waiting gets a token, so they do not pile up across pops
+        if(ring->policy == RTP_RING_BLOCK && ring->room_wait)
+        {
+                ring->room_wait = 0;
+                rtw_up_sema(&ring->room_sema);
+        }
         rtw_mutex_get(&pckt->lock);
+        pckt->index = desc.index;
+        pckt->data = desc.data;
+        pckt->len = desc.len;
+        pckt->ts = desc.ts;
         pckt->status = RTP_PCKT_PROCESS;
-        rtw_mutex_put(&pckt->lock);        
+        rtw_mutex_put(&pckt->lock);
         //printf("\n\rprocess");
+        return 0;
 }
 
-//return 0 means frame has been sent
-int rtp_sink_wait_frame_sent(rtp_sink_t *sink)
+//return 0 means a new frame can be queued without overflow, wait up to timeout_ms for a free slot
+int rtp_sink_wait_frame_sent(rtp_sink_t *sink, u32 timeout_ms)
 {
-        struct rtp_packet *pckt = sink->packet;  
-        if(pckt->status == RTP_PCKT_IDLE)
+        if(rtp_sink_ring_level(sink) < (int)sink->ring.depth)
             return 0;
-	else
+        if(timeout_ms == 0 || sink->ring.slot == NULL)
             return -1;
+        //drop a token left by a pop that raced with the previous wait
+        rtw_down_timeout_sema(&sink->ring.room_sema, 0);
+        sink->ring.room_wait = 1;
+        RING_BARRIER();
+        if(rtp_sink_ring_level(sink) >= (int)sink->ring.depth)
+            rtw_down_timeout_sema(&sink->ring.room_sema, timeout_ms);
+        sink->ring.room_wait = 0;
+        return (rtp_sink_ring_level(sink) < (int)sink->ring.depth) ? 0 : -1;
 }
                         
-int rtp_sink_wait_frame_ready(rtp_sink_t *sink)
+//return 0 means a frame is pending, otherwise sleep up to timeout_ms until one arrives or rtp_sink_wakeup
+int rtp_sink_wait_frame_ready(rtp_sink_t *sink, u32 timeout_ms)
 {
-        struct rtp_packet *pckt = sink->packet; 
-        //printf("\n\r%d", pckt->status);
-        if(pckt->status == RTP_PCKT_READY)
+        if(rtp_sink_ring_level(sink) > 0)
             return 0;
-	else
+        if(timeout_ms == 0 || sink->ring.slot == NULL)
             return -1;
-}  
+        rtw_down_timeout_sema(&sink->ring.ready_sema, timeout_ms);
+        return (rtp_sink_ring_level(sink) > 0) ? 0 : -1;
+}
+
+//kick a sleeping sender so that it rechecks session state
+void rtp_sink_wakeup(rtp_sink_t *sink)
+{
+        if(sink->ring.slot != NULL)
+            rtw_up_sema(&sink->ring.ready_sema);
+}
+
+static int rtp_sink_sendv_once(rtp_sink_t *sink, struct sockaddr_in *to, u8 *hdr, int hdr_len, u8 *payload, int payload_len)
+{
+#if RTP_SINK_SENDMSG
+        struct iovec iov[2];
+        struct msghdr msg;
+        sink->tx_call_cnt++;
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = hdr_len;
+        iov[1].iov_base = payload;
+        iov[1].iov_len = payload_len;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = to;
+        msg.msg_namelen = sizeof(struct sockaddr_in);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (payload_len > 0) ? 2 : 1;
+        return sendmsg(sink->rtp_sock, &msg, 0);
+#else
+        u8 *buf;
+        int ret;
+        if(hdr_len + payload_len > sink->tx_pool.buf_size || (buf = rtp_buf_get(&sink->tx_pool)) == NULL)
+                return -1;
+        sink->tx_call_cnt++;
+        memcpy(buf, hdr, hdr_len);
+        memcpy(buf + hdr_len, payload, payload_len);
+        ret = sendto(sink->rtp_sock, buf, hdr_len + payload_len, 0, (struct sockaddr *)to, sizeof(struct sockaddr_in));
+        rtp_buf_put(&sink->tx_pool, buf);
+        return ret;
+#endif
+}
+
+//stack is short of tx buffers, keep a few skb for the rest of system
+static int rtp_sink_tx_congested(void)
+{
+#if !defined(__linux__)
+        return (skbdata_used_num > (max_skb_buf_num - 3));
+#else
+        return 0;
+#endif
+}
+
+static void rtp_sink_pace_refill(struct rtp_pacer *p)
+{
+        u32 now = rtw_get_current_time();
+        u32 ms = rtw_systime_to_ms(now - p->last_time);
+        if(ms == 0)
+                return;
+        p->last_time = now;
+        if(p->rate == 0)
+        {
+                p->tokens = p->burst;
+                return;
+        }
+        if((u64)p->rate * ms / 1000 >= (u64)p->burst)
+                p->tokens = p->burst;
+        else
+        {
+                p->tokens += (int)((u64)p->rate * ms / 1000);
+                if(p->tokens > (int)p->burst)
+                        p->tokens = p->burst;
+        }
+}
+
+//pacer waits on its own, sink->batch is flushed first so nothing queued is held while sleeping
+static void rtp_sink_pace(rtp_sink_t *sink, int len)
+{
+        struct rtp_pacer *p = &sink->pacer;
+        rtp_sink_pace_refill(p);
+        //budget is per frame, so a slow frame does not hold the fan-out locks for a sleep per packet
+        while(p->frame_wait < p->wait_budget)
+        {
+                if(rtp_sink_tx_congested())
+                {
+                        //occupancy is just another reason to be out of tokens
+                        p->tokens = 0;
+                        p->congest_cnt++;
+                }else if(p->rate == 0 || p->tokens >= len || p->tokens == (int)p->burst)
+                        break;
+                if(sink->batch != NULL)
+                        rtp_sink_flush(sink);
+                p->wait_cnt++;
+                rtw_msleep_os(1);
+                p->frame_wait++;
+                rtp_sink_pace_refill(p);
+        }
+        p->tokens -= len;
+}
+
+//base rate comes from bit_rate, which is also advertised as b=AS
+void rtp_sink_pace_init(rtp_sink_t *sink)
+{
+        struct rtp_pacer *p = &sink->pacer;
+        memset(p, 0, sizeof(struct rtp_pacer));
+        p->base_rate = sink->bit_rate / 8;
+        p->rate = p->base_rate;
+        p->burst = RTP_PACE_BURST;
+        p->tokens = p->burst;
+        p->last_time = rtw_get_current_time();
+        p->wait_budget = RTP_PACE_WAIT_MAX;
+}
+
+//set rate for the frame about to be sent, frame_bytes counts every udp destination
+//a new ts starts a new wait budget, at most the paced share of frame interval
+void rtp_sink_pace_frame(rtp_sink_t *sink, u32 frame_bytes, u32 ts)
+{
+        struct rtp_pacer *p = &sink->pacer;
+        u32 need = 0;
+        if(sink->frame_rate > 0)
+                need = (u32)((u64)frame_bytes * sink->frame_rate * 100 / RTP_PACE_FRAME_PCT);
+        p->rate = (need > p->base_rate) ? need : p->base_rate;
+        if(ts != p->frame_ts)
+        {
+                p->frame_ts = ts;
+                p->frame_wait = 0;
+                p->wait_budget = RTP_PACE_WAIT_MAX;
+                if(sink->frame_rate > 0 && 10 * RTP_PACE_FRAME_PCT / sink->frame_rate < p->wait_budget)
+                        p->wait_budget = 10 * RTP_PACE_FRAME_PCT / sink->frame_rate;
+        }
+}
+
+//send one rtp packet made of a header slice and a payload referenced in caller's frame, addr in network order
+int rtp_sink_sendv(rtp_sink_t *sink, u32 addr, u16 port, u8 *hdr, int hdr_len, u8 *payload, int payload_len)
+{
+        struct sockaddr_in to;
+        int ret, retry_cnt = RTP_SINK_SEND_RETRY;
+        memset(&to, 0, sizeof(to));
+        to.sin_family = AF_INET;
+        to.sin_addr.s_addr = addr;
+        to.sin_port = htons(port);
+        rtp_sink_pace(sink, hdr_len + payload_len);
+        ret = rtp_sink_sendv_once(sink, &to, hdr, hdr_len, payload, payload_len);
+        while(ret < 0 && retry_cnt-- > 0)
+        {
+                rtw_msleep_os(1);
+                ret = rtp_sink_sendv_once(sink, &to, hdr, hdr_len, payload, payload_len);
+        }
+        if(ret < 0)
+                return -EAGAIN;
+        sink->tx_packet_cnt++;
+        sink->octet_cnt += hdr_len + payload_len;
+        return 0;
+}
+
+//set up everything the send path needs so that it never allocates, batch memory is optional
+int rtp_sink_tx_init(rtp_sink_t *sink)
+{
+        sink->tx_packet_cnt = 0;
+        sink->tx_call_cnt = 0;
+        sink->tx_frame_cnt = 0;
+        sink->tx_start_time = rtw_get_current_time();
+        rtp_sink_pace_init(sink);
+        if(rtp_buf_pool_init(&sink->tx_pool, RTP_MTU_SIZE, RTP_SINK_POOL_NB) < 0)
+                return -ENOMEM;
+#if RTP_SINK_BATCH
+        sink->batch = malloc(sizeof(struct rtp_sink_batch));
+        if(sink->batch == NULL)
+                RTP_WARN("allocate tx batch failed, send per packet");
+        else
+                memset(sink->batch, 0, sizeof(struct rtp_sink_batch));
+#else
+        sink->batch = NULL;
+#endif
+        return 0;
+}
+
+void rtp_sink_tx_deinit(rtp_sink_t *sink)
+{
+        if(sink->batch != NULL)
+        {
+                rtp_sink_flush(sink);
+                free(sink->batch);
+        }
+        sink->batch = NULL;
+        rtp_buf_pool_free(&sink->tx_pool);
+}
+
+//same as rtp_sink_sendv but may hold the packet until rtp_sink_flush, header is copied and
+//payload must stay valid until flush
+int rtp_sink_sendv_queue(rtp_sink_t *sink, u32 addr, u16 port, u8 *hdr, int hdr_len, u8 *payload, int payload_len)
+{
+#if RTP_SINK_BATCH
+        struct rtp_sink_batch *b = sink->batch;
+        int i, ret = 0;
+        if(b == NULL || hdr_len > RTP_FRAG_HDR_MAX)
+                return rtp_sink_sendv(sink, addr, port, hdr, hdr_len, payload, payload_len);
+        rtp_sink_pace(sink, hdr_len + payload_len);
+        if(b->cnt == RTP_SINK_BATCH_MAX)
+                ret = rtp_sink_flush(sink);
+        i = b->cnt++;
+        memcpy(b->hdr[i], hdr, hdr_len);
+        memset(&b->to[i], 0, sizeof(struct sockaddr_in));
+        b->to[i].sin_family = AF_INET;
+        b->to[i].sin_addr.s_addr = addr;
+        b->to[i].sin_port = htons(port);
+        b->iov[2 * i].iov_base = b->hdr[i];
+        b->iov[2 * i].iov_len = hdr_len;
+        b->iov[2 * i + 1].iov_base = payload;
+        b->iov[2 * i + 1].iov_len = payload_len;
+        b->len[i] = hdr_len + payload_len;
+        memset(&b->msg[i], 0, sizeof(struct mmsghdr));
+        b->msg[i].msg_hdr.msg_name = &b->to[i];
+        b->msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        b->msg[i].msg_hdr.msg_iov = &b->iov[2 * i];
+        b->msg[i].msg_hdr.msg_iovlen = 2;
+        return ret;
+#else
+        return rtp_sink_sendv(sink, addr, port, hdr, hdr_len, payload, payload_len);
+#endif
+}
+
+#if RTP_SINK_BATCH
+//number of queued packets from first that fit one GSO send: same destination, same size, last may be shorter
+static int rtp_sink_batch_run(struct rtp_sink_batch *b, int first)
+{
+        int i, end = b->cnt;
+        //super buffer is still one udp datagram for the stack
+        if(first + RTP_SINK_GSO_MAX_SIZE / b->len[first] < end)
+                end = first + RTP_SINK_GSO_MAX_SIZE / b->len[first];
+        for(i = first + 1; i < end; i++)
+        {
+                if(b->to[i].sin_addr.s_addr != b->to[first].sin_addr.s_addr || b->to[i].sin_port != b->to[first].sin_port)
+                        break;
+                if(b->len[i] > b->len[first])
+                        break;
+                if(b->len[i] < b->len[first])
+                        return i - first + 1;
+        }
+        return i - first;
+}
+
+//0 on success, -EPERM if kernel does not do UDP GSO on this socket
+static int rtp_sink_send_gso(rtp_sink_t *sink, struct rtp_sink_batch *b, int first, int run)
+{
+        struct msghdr msg;
+        struct cmsghdr *cm;
+        u8 ctrl[CMSG_SPACE(sizeof(uint16_t))];
+        int ret, retry_cnt = RTP_SINK_SEND_RETRY;
+        memset(&msg, 0, sizeof(msg));
+        memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_name = &b->to[first];
+        msg.msg_namelen = sizeof(struct sockaddr_in);
+        msg.msg_iov = &b->iov[2 * first];
+        msg.msg_iovlen = 2 * run;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cm) = (uint16_t)b->len[first];
+        while(1)
+        {
+                sink->tx_call_cnt++;
+                ret = sendmsg(sink->rtp_sock, &msg, 0);
+                if(ret >= 0)
+                        return 0;
+                if(errno == EINVAL || errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP)
+                        return -EPERM;
+                if(retry_cnt-- <= 0)
+                        return -EAGAIN;
+                rtw_msleep_os(1);
+        }
+}
+
+static int rtp_sink_send_mmsg(rtp_sink_t *sink, struct rtp_sink_batch *b, int first, int n)
+{
+        int ret, retry_cnt = RTP_SINK_SEND_RETRY;
+        while(n > 0)
+        {
+                sink->tx_call_cnt++;
+                ret = sendmmsg(sink->rtp_sock, &b->msg[first], n, 0);
+                if(ret <= 0)
+                {
+                        if(retry_cnt-- <= 0)
+                                return -EAGAIN;
+                        rtw_msleep_os(1);
+                        continue;
+                }
+                first += ret;
+                n -= ret;
+        }
+        return 0;
+}
+#endif
+
+//push out everything queued by rtp_sink_sendv_queue
+int rtp_sink_flush(rtp_sink_t *sink)
+{
+#if RTP_SINK_BATCH
+        struct rtp_sink_batch *b = sink->batch;
+        int i = 0, j, run, ret = 0;
+        if(b == NULL || b->cnt == 0)
+                return 0;
+        while(i < b->cnt)
+        {
+                if(!sink->gso_off)
+                {
+                        run = rtp_sink_batch_run(b, i);
+                        if(run > 1)
+                        {
+                                int err = rtp_sink_send_gso(sink, b, i, run);
+                                if(err == 0)
+                                {
+                                        for(j = i; j < i + run; j++)
+                                                sink->octet_cnt += b->len[j];
+                                        sink->tx_packet_cnt += run;
+                                        i += run;
+                                        continue;
+                                }
+                                if(err == -EPERM)
+                                {
+                                        RTP_INFO("udp gso not supported, use sendmmsg");
+                                        sink->gso_off = 1;
+                                }
+                        }
+                        //packets up to the next GSO run go out in one sendmmsg
+                        for(j = i + 1; j < b->cnt && (sink->gso_off || rtp_sink_batch_run(b, j) == 1); j++);
+                }else
+                        j = b->cnt;
+                if(rtp_sink_send_mmsg(sink, b, i, j - i) < 0)
+                {
+                        ret = -EAGAIN;
+                        break;
+                }
+                for(run = i; run < j; run++)
+                        sink->octet_cnt += b->len[run];
+                sink->tx_packet_cnt += j - i;
+                i = j;
+        }
+        b->cnt = 0;
+        return ret;
+#else
+        return 0;
+#endif
+}
+
+void rtp_sink_tx_dump(rtp_sink_t *sink)
+{
+        u32 ms = rtw_systime_to_ms(rtw_get_current_time() - sink->tx_start_time);
+        u32 frames = (sink->tx_frame_cnt > 0) ? sink->tx_frame_cnt : 1;
+        RTP_INFO("%s tx packets:%d calls:%d frames:%d chunked:%d pace wait:%d congest:%d pps:%d calls/frame:%d.%02d", sink->codec_name, \
+                 sink->tx_packet_cnt, sink->tx_call_cnt, sink->tx_frame_cnt, sink->frags.flush_cnt, sink->pacer.wait_cnt, sink->pacer.congest_cnt, \
+                 (ms > 0) ? (int)((u64)sink->tx_packet_cnt * 1000 / ms) : 0, \
+                 sink->tx_call_cnt / frames, (sink->tx_call_cnt % frames) * 100 / frames);
+}
 
 int rtp_sink_stats_init(rtp_sink_t *sink)
 {
@@ -4,15 +4,104 @@
 #include "rtp_avcodec/avcodec.h"
 #include "rtp_avcodec/avcodec_util.h"
 #include "rtp_common.h"
+#include "lwip/init.h" //for LWIP_VERSION_MAJOR, must precede RTP_SINK_SENDMSG below
 
 #define SINK_FLAG_FRAME_BY_REF		0x01
 #define SINK_FLAG_FRAME_BY_BUF		0x02
 #define SINK_FLAG_UNSPECIFIED		0x00
+#define SINK_FLAG_PCM_INPUT		0x04	//audio frames are 16 bit linear pcm, packetizer encodes them
+
+//audio packet duration in ms, trades latency for header overhead
+#define RTP_PTIME_DEF			20
+
+//scatter/gather transmit maps to sendmsg where the stack has it (linux, lwIP 2.x lwip_sendmsg),
+//older lwIP falls back to assembling the datagram in a stack buffer
+#ifndef RTP_SINK_SENDMSG
+#if !defined(__linux__) && !defined(LWIP_VERSION_MAJOR)
+#error "LWIP_VERSION_MAJOR unknown, set RTP_SINK_SENDMSG explicitly"
+#endif
+#if defined(__linux__) || (LWIP_VERSION_MAJOR >= 2)
+#define RTP_SINK_SENDMSG		1
+#else
+#define RTP_SINK_SENDMSG		0
+#endif
+#endif
+#define RTP_SINK_SEND_RETRY		3
+#define RTP_SINK_POOL_NB		2	//per destination header copy + datagram assembly without sendmsg
+
+//batched transmit: packets of a frame are queued and flushed with sendmmsg at frame end, runs of
+//equal sized packets to one destination go out as one UDP GSO super buffer if kernel supports it
+#ifndef RTP_SINK_BATCH
+#if defined(__linux__)
+#define RTP_SINK_BATCH			1
+#else
+#define RTP_SINK_BATCH			0
+#endif
+#endif
+#define RTP_SINK_BATCH_MAX		64	//also max segments per GSO send
+struct rtp_sink_batch;
+
+//token bucket pacing of udp packets, rate is the larger of bit_rate and what it takes to
+//send current frame within RTP_PACE_FRAME_PCT of frame interval
+#define RTP_PACE_BURST			(4 * RTP_MTU_SIZE)	//bucket depth in bytes
+#define RTP_PACE_FRAME_PCT		80
+#define RTP_PACE_WAIT_MAX		100	//in ms, never hold a frame longer than this in total
+
+struct rtp_pacer{
+	u32 base_rate; //bytes per second from bit_rate, 0 if unknown
+	u32 rate; //bytes per second for current frame, 0 disables pacing
+	u32 burst;
+	int tokens;
+	u32 last_time;
+	u32 frame_ts; //frame the wait budget belongs to, chunks of one frame share it
+	u32 frame_wait; //ms slept so far for current frame
+	u32 wait_budget; //ms current frame may sleep
+	u32 wait_cnt; //times sender slept for tokens
+	u32 congest_cnt; //times stack buffer occupancy emptied the bucket
+};
+
+//frame ring between encoder (single producer) and rtp task (single consumer)
+#define RTP_RING_DEPTH_DEF		4	//rounded up to power of 2
+#define RTP_RING_DEPTH_MAX		32
+#define RTP_RING_BLOCK_TIMEOUT		1000	//in ms, block policy falls back to drop newest
+#define RTP_FRAME_WAIT_TIMEOUT		500	//in ms, sender rechecks session state at least this often
+
+enum rtp_ring_policy{
+	RTP_RING_DROP_OLDEST = 0,	//keep latency low, replace the oldest pending frame
+	RTP_RING_DROP_NEWEST = 1,	//keep pending frames, reject the incoming one
+	RTP_RING_BLOCK = 2		//stall encoder until sender frees a slot
+};
+
+struct rtp_frame_desc{
+	int index; //internal buffer index if we get frame by ref instead of by copy
+	u8 *data;
+	int len;
+	u32 ts;
+};
+
+struct rtp_frame_ring{
+	struct rtp_frame_desc *slot;
+	u32 depth;
+	volatile u32 head; //written by producer only
+	volatile u32 tail; //written by consumer, or by producer when dropping oldest
+	u8 policy;
+	_sema ready_sema; //given when ring turns non-empty or sender should recheck state
+	_sema room_sema; //given when a slot is freed while producer waits on it
+	volatile u8 room_wait; //set by blocking producer before it sleeps on room_sema
+	//occupancy counters
+	u32 push_cnt;
+	u32 pop_cnt;
+	u32 drop_oldest_cnt;
+	u32 drop_newest_cnt;
+	u32 block_cnt;
+	u32 level_max;
+};
 
 //structure for sending data
 typedef struct _rtp_sink{
         int rtp_sock;
         int rtcp_sock;
+        u8 mcast_ttl; //multicast ttl currently applied on rtp_sock
 	u32 ssrc;
 	u32 base_ts; //base timestamp
 	u32 now_ts;
@@ -22,6 +111,7 @@ typedef struct _rtp_sink{
 	u8 media_type;
 	u8 pt;//payload type
 	u8 nb_channels;
+	u8 ptime; //audio packet duration in ms
 	u32 frequency;
 	u8 frame_rate;
 	u32 bit_rate;	
@@ -29,7 +119,18 @@ typedef struct _rtp_sink{
 	u32 octet_cnt;
 	u32 total_octet_cnt;
 	u8 sink_flag;
-	struct rtp_packet *packet;
+	//transmit counters, packets and socket calls, for tuning batching
+	u32 tx_packet_cnt;
+	u32 tx_call_cnt;
+	u32 tx_frame_cnt;
+	u32 tx_start_time;
+	struct rtp_buf_pool tx_pool; //mtu sized buffers for the send path
+	struct rtp_sink_batch *batch; //NULL when sending one packet per call
+	u8 gso_off; //kernel refused UDP_SEGMENT, stick to sendmmsg
+	struct rtp_pacer pacer;
+	struct rtp_packet *packet; //frame being sent
+	struct rtp_frame_ring ring; //frames waiting to be sent
+	struct rtp_frag_list frags; //packets of current frame shared by all destinations
 	struct avcodec_handle_ops *media_hdl_ops;	
 	rtp_trans_stats *stats; 
 	//rtcp_instance *rtcp_inst;
@@ -43,15 +144,30 @@ int rtp_sink_is_frame_by_buf(rtp_sink_t *sink);
 void rtp_sink_set_frame_by_none(rtp_sink_t *sink);
 void rtp_sink_set_frame_by_ref(rtp_sink_t *sink);
 void rtp_sink_set_frame_by_buf(rtp_sink_t *sink);
-int rtp_sink_packet_create(rtp_sink_t *sink);        
+int rtp_sink_is_pcm_input(rtp_sink_t *sink);
+void rtp_sink_set_pcm_input(rtp_sink_t *sink, int enable);
+int rtp_sink_set_ptime(rtp_sink_t *sink, int ptime);
+int rtp_sink_set_ring(rtp_sink_t *sink, int depth, u8 policy);
+int rtp_sink_ring_level(rtp_sink_t *sink);
+void rtp_sink_ring_flush(rtp_sink_t *sink);
+void rtp_sink_ring_dump(rtp_sink_t *sink);
+int rtp_sink_packet_create(rtp_sink_t *sink);
 int rtp_sink_packet_init(rtp_sink_t *sink);
 void rtp_sink_packet_free(rtp_sink_t *sink);
 void rtp_sink_ind_frame_sent(rtp_sink_t *sink);
-int rtp_sink_wait_frame_sent(rtp_sink_t *sink);
-void rtp_sink_ind_frame_ready(rtp_sink_t *sink);
-int rtp_sink_wait_frame_ready(rtp_sink_t *sink);
-void rtp_sink_ind_frame_process(rtp_sink_t *sink);
+int rtp_sink_wait_frame_sent(rtp_sink_t *sink, u32 timeout_ms);
+int rtp_sink_wait_frame_ready(rtp_sink_t *sink, u32 timeout_ms);
+void rtp_sink_wakeup(rtp_sink_t *sink);
+int rtp_sink_ind_frame_process(rtp_sink_t *sink);
 int rtp_sink_get_frame(rtp_sink_t *sink, int index, u8 *src, int len);
+int rtp_sink_sendv(rtp_sink_t *sink, u32 addr, u16 port, u8 *hdr, int hdr_len, u8 *payload, int payload_len);
+void rtp_sink_pace_init(rtp_sink_t *sink);
+void rtp_sink_pace_frame(rtp_sink_t *sink, u32 frame_bytes, u32 ts);
+int rtp_sink_tx_init(rtp_sink_t *sink);
+void rtp_sink_tx_deinit(rtp_sink_t *sink);
+int rtp_sink_sendv_queue(rtp_sink_t *sink, u32 addr, u16 port, u8 *hdr, int hdr_len, u8 *payload, int payload_len);
+int rtp_sink_flush(rtp_sink_t *sink);
+void rtp_sink_tx_dump(rtp_sink_t *sink);
 int rtp_sink_stats_init(rtp_sink_t *sink);
 int rtp_sink_rtcp_init(rtp_sink_t *sink);
 
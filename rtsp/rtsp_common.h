@@ -30,6 +30,7 @@
 #define RTSP_RES_OK "RTSP/1.0 200 OK"
 #define RTSP_RES_BAD "RTSP/1.0 400 Bad Request"
 #define RTSP_RES_SNF "RTSP/1.0 454 Session Not Found"
+#define RTSP_RES_UNAVAILABLE "RTSP/1.0 503 Service Unavailable"
 
 /* rtsp header field particulars */
 
@@ -49,8 +50,6 @@
 //accept&levels
 #define ACCEPT_STR_SDP	"application/sdp"
 
-#define PUBLIC_CMD_STR	"Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER"
-#define ALLOW_CMD_STR	"Allow: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER"
 
 /**************************************STRUCTURES********************************************************/
 
@@ -67,6 +66,10 @@ struct rtsp_session_info
 };
 
 /* rtsp transport header field struct */
+/* port pairs of a transport the server allocated itself */
+#define RTSP_PORT_CLAIMED_CLIENT	0x01
+#define RTSP_PORT_CLAIMED_MCAST		0x04
+
 struct rtsp_transport
 {
 	u8 cast_mode; //unicast or multicast
@@ -79,7 +82,10 @@ struct rtsp_transport
 	u16 client_port_odd;
 	u16 server_port_even; //unicast RTP/RTCP port pair for server 
 	u16 server_port_odd;
+	u8 interleaved_even; //RTP/RTCP channel pair when interleaved on rtsp connection
+	u8 interleaved_odd;
 	u32 ssrc; //only valid for unicast transmission
+	u8 port_claimed; //RTSP_PORT_CLAIMED_* pairs that came from our allocator, others belong to client
 };
 
 /* rtsp message specifics for use */
@@ -90,6 +96,7 @@ struct rtsp_message{
 	int method;
 	//vital header field info
 	u32 CSeq;
+	u32 session_id; //0 if request carries no Session header
 	u32 bandwidth; //measured in bits per sec
 	u32 content_length; //must be set if any content
 	struct rtsp_transport transport;
@@ -0,0 +1,375 @@
+#include "platform/platform_stdlib.h"
+#include "osdep_service.h"
+#include "rtsp_rtp_dbg.h"
+#include "rtsp_common.h" //for method ids
+#include "rtsp_parser.h"
+
+#define RTSP_INTERLEAVED_HDR_SZ		4	//'$' + channel + 16 bit length
+
+static const struct rtsp_keyword rtsp_method_kw[] = {
+	{"OPTIONS", 7, RTSP_REQ_OPTIONS},
+	{"DESCRIBE", 8, RTSP_REQ_DESCRIBE},
+	{"SETUP", 5, RTSP_REQ_SETUP},
+	{"TEARDOWN", 8, RTSP_REQ_TEARDOWN},
+	{"PLAY", 4, RTSP_REQ_PLAY},
+	{"PAUSE", 5, RTSP_REQ_PAUSE},
+	{"GET_PARAMETER", 13, RTSP_REQ_GET_PARAMETER},
+};
+static const s8 rtsp_method_slot[16] = {0, 4, 3, 6, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 5};
+const struct rtsp_keyword_table rtsp_method_table = {rtsp_method_kw, 7, rtsp_method_slot, 16, 2, 1, 0};
+
+static const struct rtsp_keyword rtsp_header_kw[] = {
+	{"CSeq", 4, RTSP_HDR_CSEQ},
+	{"Session", 7, RTSP_HDR_SESSION},
+	{"Transport", 9, RTSP_HDR_TRANSPORT},
+	{"Content-Length", 14, RTSP_HDR_CONTENT_LENGTH},
+	{"Content-Type", 12, RTSP_HDR_CONTENT_TYPE},
+	{"Accept", 6, RTSP_HDR_ACCEPT},
+	{"Require", 7, RTSP_HDR_REQUIRE},
+	{"Range", 5, RTSP_HDR_RANGE},
+	{"User-Agent", 10, RTSP_HDR_USER_AGENT},
+	{"Bandwidth", 9, RTSP_HDR_BANDWIDTH},
+	{"Public", 6, RTSP_HDR_PUBLIC},
+	{"Content-Base", 12, RTSP_HDR_CONTENT_BASE},
+};
+static const s8 rtsp_header_slot[16] = {-1, 3, 7, 8, -1, 2, -1, -1, 1, -1, 0, 5, 6, -1, 4, 9};
+const struct rtsp_keyword_table rtsp_header_table = {rtsp_header_kw, 12, rtsp_header_slot, 16, 13, 3, 1};
+
+static const struct rtsp_keyword rtsp_transport_kw[] = {
+	{"unicast", 7, RTSP_TP_UNICAST},
+	{"multicast", 9, RTSP_TP_MULTICAST},
+	{"interleaved", 11, RTSP_TP_INTERLEAVED},
+	{"ttl", 3, RTSP_TP_TTL},
+	{"client_port", 11, RTSP_TP_CLIENT_PORT},
+	{"port", 4, RTSP_TP_PORT},
+	{"server_port", 11, RTSP_TP_SERVER_PORT},
+	{"ssrc", 4, RTSP_TP_SSRC},
+	{"destination", 11, RTSP_TP_DESTINATION},
+	{"mode", 4, RTSP_TP_MODE},
+	{"append", 6, RTSP_TP_APPEND},
+	{"source", 6, RTSP_TP_SOURCE},
+	{"layers", 6, RTSP_TP_LAYERS},
+};
+static const s8 rtsp_transport_slot[32] = {-1, -1, 4, 3, -1, 12, -1, -1, 5, -1, 1, 10, -1, -1, -1, -1, 0, -1, 6, -1, -1, -1, 9, -1, 2, -1, 7, -1, -1, 8, 11, -1};
+const struct rtsp_keyword_table rtsp_transport_table = {rtsp_transport_kw, 13, rtsp_transport_slot, 32, 1, 1, 0};
+
+static int rtsp_lower(u8 c)
+{
+	return (c >= 'A' && c <= 'Z') ? (c + 'a' - 'A') : c;
+}
+
+int rtsp_str_eq(struct rtsp_str *s, const char *lit)
+{
+	int n = strlen(lit);
+	return (s->len == n && memcmp(s->ptr, lit, n) == 0);
+}
+
+//header names are case-insensitive
+int rtsp_str_case_eq(struct rtsp_str *s, const char *lit)
+{
+	int i, n = strlen(lit);
+	if(s->len != n)
+		return 0;
+	for(i = 0; i < n; i++)
+	{
+		if(rtsp_lower(s->ptr[i]) != rtsp_lower((u8)lit[i]))
+			return 0;
+	}
+	return 1;
+}
+
+//stop at first character that is not a digit of base, base is 10 or 16
+u32 rtsp_str_to_u32(struct rtsp_str *s, int base)
+{
+	u32 v = 0;
+	int i, d;
+	u8 c;
+	for(i = 0; i < s->len; i++)
+	{
+		c = s->ptr[i];
+		if(c >= '0' && c <= '9')
+			d = c - '0';
+		else if(base == 16 && rtsp_lower(c) >= 'a' && rtsp_lower(c) <= 'f')
+			d = rtsp_lower(c) - 'a' + 10;
+		else
+			break;
+		v = v * base + d;
+	}
+	return v;
+}
+
+void rtsp_str_trim(struct rtsp_str *s)
+{
+	while(s->len > 0 && (*s->ptr == ' ' || *s->ptr == '\t'))
+	{
+		s->ptr++;
+		s->len--;
+	}
+	while(s->len > 0 && (s->ptr[s->len - 1] == ' ' || s->ptr[s->len - 1] == '\t' || s->ptr[s->len - 1] == '\r' || s->ptr[s->len - 1] == '\n'))
+		s->len--;
+}
+
+//reentrant replacement of strtok: cut next token off s at sep, return 0 when s is exhausted
+int rtsp_str_split(struct rtsp_str *s, u8 sep, struct rtsp_str *token)
+{
+	u8 *end;
+	if(s->len <= 0)
+		return 0;
+	end = memchr(s->ptr, sep, s->len);
+	token->ptr = s->ptr;
+	if(end == NULL)
+	{
+		token->len = s->len;
+		s->ptr += s->len;
+		s->len = 0;
+	}else{
+		token->len = end - s->ptr;
+		s->len -= token->len + 1;
+		s->ptr = end + 1;
+	}
+	return 1;
+}
+
+//return id of keyword or -1, one hash and one compare whatever the table size
+int rtsp_keyword_lookup(const struct rtsp_keyword_table *t, struct rtsp_str *s)
+{
+	const struct rtsp_keyword *kw;
+	int slot;
+	if(s->len <= 0 || s->len > 255)
+		return -1;
+	slot = t->slot[(s->len * t->mul_len + rtsp_lower(s->ptr[0]) + rtsp_lower(s->ptr[s->len - 1]) * t->mul_last) & (t->slot_nb - 1)];
+	if(slot < 0)
+		return -1;
+	kw = &t->kw[slot];
+	if(t->fold ? rtsp_str_case_eq(s, kw->name) : rtsp_str_eq(s, kw->name))
+		return kw->id;
+	return -1;
+}
+
+const char *rtsp_keyword_name(const struct rtsp_keyword_table *t, int id)
+{
+	int i;
+	for(i = 0; i < t->kw_nb; i++)
+	{
+		if(t->kw[i].id == id)
+			return t->kw[i].name;
+	}
+	return NULL;
+}
+
+//comma separated list of supported methods for Public header, return length
+int rtsp_method_list(u8 *buf, int size)
+{
+	int i, len = 0;
+	const struct rtsp_keyword *kw;
+	for(i = 0; i < rtsp_method_table.kw_nb; i++)
+	{
+		kw = &rtsp_method_table.kw[i];
+		if(len + kw->len + 3 > size)
+			break;
+		if(len > 0)
+		{
+			buf[len++] = ',';
+			buf[len++] = ' ';
+		}
+		memcpy(buf + len, kw->name, kw->len);
+		len += kw->len;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+void rtsp_parser_init(struct rtsp_parser *p, u8 *buf, int buf_size)
+{
+	memset(p, 0, sizeof(struct rtsp_parser));
+	p->buf = buf;
+	p->buf_size = buf_size;
+	p->state = RTSP_PARSE_IDLE;
+}
+
+//where to read next bytes to, consumed bytes are dropped first so views of a completed request become invalid
+u8 *rtsp_parser_space(struct rtsp_parser *p, int *room)
+{
+	int i;
+	//views of a finished request are released here, drop it instead of moving it
+	if(p->state == RTSP_PARSE_IDLE)
+		p->start = p->pos;
+	if(p->start > 0)
+	{
+		//views of a request still being parsed move along with it
+		p->method.ptr -= p->start;
+		p->uri.ptr -= p->start;
+		p->version.ptr -= p->start;
+		for(i = 0; i < RTSP_HDR_NB; i++)
+		{
+			if(p->hdr[i].ptr != NULL)
+				p->hdr[i].ptr -= p->start;
+		}
+		memmove(p->buf, p->buf + p->start, p->len - p->start);
+		p->len -= p->start;
+		p->pos -= p->start;
+		p->line -= p->start;
+		p->start = 0;
+	}
+	*room = p->buf_size - p->len;
+	return p->buf + p->len;
+}
+
+void rtsp_parser_commit(struct rtsp_parser *p, int n)
+{
+	p->len += n;
+}
+
+static void rtsp_parser_begin(struct rtsp_parser *p)
+{
+	p->start = p->line = p->pos;
+	memset(p->hdr, 0, sizeof(p->hdr));
+	p->hdr_last = -1;
+	p->content_length = 0;
+	p->method.len = p->uri.len = p->version.len = p->body.len = 0;
+	p->state = RTSP_PARSE_REQ_LINE;
+}
+
+static int rtsp_parser_req_line(struct rtsp_parser *p, struct rtsp_str *line)
+{
+	if(!rtsp_str_split(line, ' ', &p->method) || !rtsp_str_split(line, ' ', &p->uri))
+		return -EINVAL;
+	p->version = *line;
+	if(p->method.len == 0 || p->version.len < 4 || memcmp(p->version.ptr, "RTSP", 4) != 0)
+		return -EINVAL;
+	return 0;
+}
+
+static void rtsp_parser_header_line(struct rtsp_parser *p, struct rtsp_str *line)
+{
+	struct rtsp_str name;
+	int id;
+	//folded continuation line extends previous value
+	if(*line->ptr == ' ' || *line->ptr == '\t')
+	{
+		if(p->hdr_last >= 0)
+			p->hdr[p->hdr_last].len = line->ptr + line->len - p->hdr[p->hdr_last].ptr;
+		return;
+	}
+	if(!rtsp_str_split(line, ':', &name))
+		return;
+	rtsp_str_trim(&name);
+	if((p->hdr_last = id = rtsp_keyword_lookup(&rtsp_header_table, &name)) < 0)
+	{
+		p->hdr_skip_cnt++;
+		return;
+	}
+	rtsp_str_trim(line);
+	p->hdr[id] = *line;
+	if(id == RTSP_HDR_CONTENT_LENGTH)
+		p->content_length = rtsp_str_to_u32(line, 10);
+}
+
+//consume buffered bytes, return RTSP_PARSE_DONE with views filled when a request is complete,
+//RTSP_PARSE_MORE when waiting for bytes, negative on malformed or oversized request
+int rtsp_parser_next(struct rtsp_parser *p)
+{
+	u8 *nl;
+	struct rtsp_str line;
+	int n;
+	while(p->pos < p->len)
+	{
+		switch(p->state)
+		{
+			case(RTSP_PARSE_IDLE):
+				p->start = p->line = p->pos;
+				if(p->buf[p->pos] == '\r' || p->buf[p->pos] == '\n')
+				{
+					p->pos++;
+					p->start = p->pos;
+					break;
+				}
+				if(p->buf[p->pos] == '$')
+				{
+					//interleaved rtcp from client, skip it whole
+					if(p->len - p->pos < RTSP_INTERLEAVED_HDR_SZ)
+						return RTSP_PARSE_MORE;
+					p->frame_left = (p->buf[p->pos + 2] << 8) | p->buf[p->pos + 3];
+					p->pos += RTSP_INTERLEAVED_HDR_SZ;
+					p->start = p->pos;
+					p->frame_cnt++;
+					p->state = RTSP_PARSE_FRAME;
+					break;
+				}
+				rtsp_parser_begin(p);
+				break;
+			case(RTSP_PARSE_FRAME):
+				n = p->len - p->pos;
+				if(n > p->frame_left)
+					n = p->frame_left;
+				p->pos += n;
+				p->frame_left -= n;
+				p->start = p->pos;
+				if(p->frame_left == 0)
+					p->state = RTSP_PARSE_IDLE;
+				break;
+			case(RTSP_PARSE_REQ_LINE):
+			case(RTSP_PARSE_HEADER):
+				nl = memchr(p->buf + p->pos, '\n', p->len - p->pos);
+				if(nl == NULL)
+				{
+					p->pos = p->len;
+					goto more;
+				}
+				p->pos = nl - p->buf + 1;
+				line.ptr = p->buf + p->line;
+				line.len = nl - line.ptr;
+				if(line.len > 0 && line.ptr[line.len - 1] == '\r')
+					line.len--;
+				p->line = p->pos;
+				if(p->state == RTSP_PARSE_REQ_LINE)
+				{
+					if(rtsp_parser_req_line(p, &line) < 0)
+					{
+						RTSP_WARN("\n\rmalformed request line");
+						return -EINVAL;
+					}
+					p->state = RTSP_PARSE_HEADER;
+				}else if(line.len == 0)
+				{
+					//end of header, body follows if any
+					p->state = RTSP_PARSE_BODY;
+				}else
+					rtsp_parser_header_line(p, &line);
+				break;
+			case(RTSP_PARSE_BODY):
+				if((u32)(p->len - p->pos) < p->content_length)
+				{
+					if((u32)p->buf_size < (u32)(p->pos - p->start) + p->content_length)
+						return -ENOMEM;
+					return RTSP_PARSE_MORE;
+				}
+				goto done;
+		}
+	}
+	//header may end exactly at buffer end
+	if(p->state == RTSP_PARSE_BODY && p->content_length == 0)
+		goto done;
+more:
+	//a request that can never fit the buffer
+	if(p->state != RTSP_PARSE_IDLE && p->state != RTSP_PARSE_FRAME && p->start == 0 && p->len == p->buf_size)
+	{
+		RTSP_WARN("\n\rrequest exceeds %d bytes", p->buf_size);
+		return -ENOMEM;
+	}
+	return RTSP_PARSE_MORE;
+done:
+	p->body.ptr = p->buf + p->pos;
+	p->body.len = p->content_length;
+	p->pos += p->content_length;
+	p->state = RTSP_PARSE_IDLE;
+	//start is kept at request begin so that views survive until next rtsp_parser_space
+	return RTSP_PARSE_DONE;
+}
+
+struct rtsp_str *rtsp_parser_header(struct rtsp_parser *p, int id)
+{
+	if(id < 0 || id >= RTSP_HDR_NB || p->hdr[id].ptr == NULL)
+		return NULL;
+	return &p->hdr[id];
+}
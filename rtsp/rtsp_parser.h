@@ -0,0 +1,132 @@
+#ifndef _RTSP_PARSER_H_
+#define _RTSP_PARSER_H_
+
+/*****************************************************INCLUDE**************************************************/
+#include "basic_types.h"
+#include "osdep_service.h"
+
+/*****************************************************DEFINITIONS**********************************************/
+
+/* header fields the server understands, others are skipped while parsing */
+#define RTSP_HDR_CSEQ		0
+#define RTSP_HDR_SESSION	1
+#define RTSP_HDR_TRANSPORT	2
+#define RTSP_HDR_CONTENT_LENGTH	3
+#define RTSP_HDR_CONTENT_TYPE	4
+#define RTSP_HDR_ACCEPT		5
+#define RTSP_HDR_REQUIRE	6
+#define RTSP_HDR_RANGE		7
+#define RTSP_HDR_USER_AGENT	8
+#define RTSP_HDR_BANDWIDTH	9
+#define RTSP_HDR_NB		10
+/* response only headers, emitted by id but left out of the slot array so never parsed */
+#define RTSP_HDR_PUBLIC		10
+#define RTSP_HDR_CONTENT_BASE	11
+
+/* transport header parameters */
+#define RTSP_TP_UNICAST		0
+#define RTSP_TP_MULTICAST	1
+#define RTSP_TP_INTERLEAVED	2
+#define RTSP_TP_TTL		3
+#define RTSP_TP_CLIENT_PORT	4
+#define RTSP_TP_PORT		5
+#define RTSP_TP_SERVER_PORT	6
+#define RTSP_TP_SSRC		7
+#define RTSP_TP_DESTINATION	8
+#define RTSP_TP_MODE		9
+#define RTSP_TP_APPEND		10
+#define RTSP_TP_SOURCE		11
+#define RTSP_TP_LAYERS		12
+
+/* return value of rtsp_parser_next */
+#define RTSP_PARSE_MORE		0	//need more bytes
+#define RTSP_PARSE_DONE		1	//one complete request available
+
+/* parser states */
+#define RTSP_PARSE_IDLE		0	//between messages, skip blank lines and interleaved frames
+#define RTSP_PARSE_FRAME	1	//inside an interleaved '$' frame
+#define RTSP_PARSE_REQ_LINE	2
+#define RTSP_PARSE_HEADER	3
+#define RTSP_PARSE_BODY		4
+
+/*****************************************************STRUCTURES***********************************************/
+
+//view into receive buffer, not NUL terminated
+struct rtsp_str
+{
+	u8 *ptr;
+	int len;
+};
+
+/*
+ * Keyword tables are looked up with a perfect hash on length, first and last
+ * character: slot = (len * mul_len + first + last * mul_last) & (slot_nb - 1),
+ * lower case. Multipliers and slot arrays were searched offline so that every
+ * keyword of a table lands in its own slot; re-run the search when adding one.
+ */
+struct rtsp_keyword
+{
+	const char *name;
+	u8 len;
+	u8 id;
+};
+
+struct rtsp_keyword_table
+{
+	const struct rtsp_keyword *kw;
+	int kw_nb;
+	const s8 *slot;
+	u8 slot_nb;
+	u8 mul_len;
+	u8 mul_last;
+	u8 fold; //compare case-insensitively
+};
+
+extern const struct rtsp_keyword_table rtsp_method_table;
+extern const struct rtsp_keyword_table rtsp_header_table;
+extern const struct rtsp_keyword_table rtsp_transport_table;
+
+/*
+ * Resumable request parser over a per-connection receive buffer. Bytes are
+ * appended as they arrive, complete requests are handed out as views into
+ * the buffer. Views stay valid until the next rtsp_parser_space call.
+ */
+struct rtsp_parser
+{
+	u8 *buf;
+	int buf_size;
+	int len; //bytes in buffer
+	int pos; //scan position
+	int start; //start of current message
+	int line; //start of current line
+	u8 state;
+	int frame_left; //bytes of interleaved frame still to skip
+	u32 frame_cnt; //interleaved frames seen
+	u32 content_length;
+	//views of last complete request
+	struct rtsp_str method;
+	struct rtsp_str uri;
+	struct rtsp_str version;
+	struct rtsp_str hdr[RTSP_HDR_NB]; //indexed by RTSP_HDR_*, ptr is NULL if absent
+	int hdr_last; //id of last header line for folding, -1 if it was skipped
+	u32 hdr_skip_cnt; //unknown header lines skipped
+	struct rtsp_str body;
+};
+
+/*****************************************************DECLARATIONS*********************************************/
+
+void rtsp_parser_init(struct rtsp_parser *p, u8 *buf, int buf_size);
+u8 *rtsp_parser_space(struct rtsp_parser *p, int *room);
+void rtsp_parser_commit(struct rtsp_parser *p, int n);
+int rtsp_parser_next(struct rtsp_parser *p);
+struct rtsp_str *rtsp_parser_header(struct rtsp_parser *p, int id);
+int rtsp_keyword_lookup(const struct rtsp_keyword_table *t, struct rtsp_str *s);
+const char *rtsp_keyword_name(const struct rtsp_keyword_table *t, int id);
+int rtsp_method_list(u8 *buf, int size);
+int rtsp_str_eq(struct rtsp_str *s, const char *lit);
+int rtsp_str_case_eq(struct rtsp_str *s, const char *lit);
+u32 rtsp_str_to_u32(struct rtsp_str *s, int base);
+int rtsp_str_split(struct rtsp_str *s, u8 sep, struct rtsp_str *token);
+void rtsp_str_trim(struct rtsp_str *s);
+
+#endif
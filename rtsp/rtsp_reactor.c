@@ -0,0 +1,246 @@
+#include "platform/platform_stdlib.h"
+#include "osdep_service.h"
+#include "rtsp_rtp_dbg.h"
+#include "rtsp_reactor.h"
+
+#include "sockets.h" //for select
+#if (RTSP_REACTOR_BACKEND == RTSP_REACTOR_POLL)
+#include <poll.h>
+#elif (RTSP_REACTOR_BACKEND == RTSP_REACTOR_EPOLL)
+#include <sys/epoll.h>
+#endif
+
+static struct rtsp_reactor_entry *rtsp_reactor_find(struct rtsp_reactor *reactor, int fd)
+{
+	int i;
+	for(i = 0; i < RTSP_REACTOR_MAX_FD; i++)
+	{
+		if(reactor->entry[i].fd == fd)
+			return &reactor->entry[i];
+	}
+	return NULL;
+}
+
+static void rtsp_reactor_on_wake(int fd, int events, void *ctx)
+{
+	u8 buf[16];
+	//several kicks collapse into one round
+	while(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+}
+
+//loopback socket that makes a blocked wait return when another task has news for the reactor
+static void rtsp_reactor_wake_open(struct rtsp_reactor *reactor)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0)
+		return;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0 \
+	   || rtsp_reactor_add(reactor, fd, REACTOR_EV_READ, rtsp_reactor_on_wake, (void *)reactor) < 0)
+	{
+		RTSP_WARN("\n\rno wakeup socket, waits run to their timeout");
+		close(fd);
+		return;
+	}
+	reactor->wake_fd = fd;
+	reactor->wake_port = addr.sin_port;
+}
+
+int rtsp_reactor_init(struct rtsp_reactor *reactor)
+{
+	int i;
+	memset(reactor, 0, sizeof(struct rtsp_reactor));
+	for(i = 0; i < RTSP_REACTOR_MAX_FD; i++)
+		reactor->entry[i].fd = -1;
+	reactor->backend_fd = -1;
+	reactor->wake_fd = -1;
+#if (RTSP_REACTOR_BACKEND == RTSP_REACTOR_EPOLL)
+	reactor->backend_fd = epoll_create1(0);
+	if(reactor->backend_fd < 0)
+	{
+		RTSP_ERROR("\n\rcreate epoll instance failed");
+		return -EIO;
+	}
+#endif
+	rtsp_reactor_wake_open(reactor);
+	return 0;
+}
+
+void rtsp_reactor_deinit(struct rtsp_reactor *reactor)
+{
+	int i, wake_fd = reactor->wake_fd;
+	//stop kicks first, the fd number may be reused right after close
+	reactor->wake_fd = -1;
+	for(i = 0; i < RTSP_REACTOR_MAX_FD; i++)
+		reactor->entry[i].fd = -1;
+	reactor->entry_cnt = 0;
+	if(wake_fd >= 0)
+		close(wake_fd);
+	if(reactor->backend_fd >= 0)
+		close(reactor->backend_fd);
+	reactor->backend_fd = -1;
+}
+
+//callable from any task, makes the current or next wait return at once
+void rtsp_reactor_wakeup(struct rtsp_reactor *reactor)
+{
+	struct sockaddr_in addr;
+	u8 kick = 0;
+	int fd = reactor->wake_fd;
+	if(fd < 0)
+		return;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = reactor->wake_port;
+	sendto(fd, &kick, 1, MSG_DONTWAIT, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+int rtsp_reactor_add(struct rtsp_reactor *reactor, int fd, int events, rtsp_reactor_cb cb, void *ctx)
+{
+	struct rtsp_reactor_entry *e;
+	if(fd < 0 || cb == NULL)
+		return -EINVAL;
+	if(rtsp_reactor_find(reactor, fd) != NULL)
+	{
+		RTSP_WARN("\n\rfd %d already watched", fd);
+		return -EPERM;
+	}
+	if((e = rtsp_reactor_find(reactor, -1)) == NULL)
+	{
+		RTSP_WARN("\n\rreactor full");
+		return -ENOMEM;
+	}
+#if (RTSP_REACTOR_BACKEND == RTSP_REACTOR_EPOLL)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u64 = ((u64)(reactor->gen_seq + 1) << 32) | (u32)(e - reactor->entry);
+		if(epoll_ctl(reactor->backend_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			RTSP_ERROR("\n\repoll add fd %d failed", fd);
+			return -EIO;
+		}
+	}
+#endif
+	e->fd = fd;
+	e->gen = ++reactor->gen_seq;
+	e->events = events;
+	e->cb = cb;
+	e->ctx = ctx;
+	reactor->entry_cnt++;
+	return 0;
+}
+
+//safe to call from a callback, the slot is simply skipped by the running dispatch
+void rtsp_reactor_del(struct rtsp_reactor *reactor, int fd)
+{
+	struct rtsp_reactor_entry *e;
+	if(fd < 0 || (e = rtsp_reactor_find(reactor, fd)) == NULL)
+		return;
+#if (RTSP_REACTOR_BACKEND == RTSP_REACTOR_EPOLL)
+	epoll_ctl(reactor->backend_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+	e->fd = -1;
+	e->cb = NULL;
+	e->ctx = NULL;
+	reactor->entry_cnt--;
+}
+
+//an entry removed or replaced by an earlier callback of the same round is skipped,
+//its readiness belongs to the closed socket and would block on the new one
+static void rtsp_reactor_dispatch(struct rtsp_reactor *reactor, int idx, u32 gen, int events)
+{
+	struct rtsp_reactor_entry *e = &reactor->entry[idx];
+	if(e->fd < 0 || e->gen != gen || e->cb == NULL)
+		return;
+	reactor->dispatch_cnt++;
+	e->cb(e->fd, events, e->ctx);
+}
+
+//wait for readiness up to timeout_ms (negative means forever) and dispatch callbacks
+//return number of ready fds, 0 on timeout
+int rtsp_reactor_run_once(struct rtsp_reactor *reactor, int timeout_ms)
+{
+	int i, ret;
+	int idx_list[RTSP_REACTOR_MAX_FD];
+	u32 gen_list[RTSP_REACTOR_MAX_FD];
+	int ev_list[RTSP_REACTOR_MAX_FD];
+	int ready = 0;
+#if (RTSP_REACTOR_BACKEND == RTSP_REACTOR_SELECT)
+	fd_set read_fds;
+	struct timeval timeout;
+	int max_fd = -1;
+	FD_ZERO(&read_fds);
+	for(i = 0; i < RTSP_REACTOR_MAX_FD; i++)
+	{
+		if(reactor->entry[i].fd < 0)
+			continue;
+		FD_SET(reactor->entry[i].fd, &read_fds);
+		if(reactor->entry[i].fd > max_fd)
+			max_fd = reactor->entry[i].fd;
+	}
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
+	ret = select(max_fd + 1, &read_fds, NULL, NULL, (timeout_ms < 0) ? NULL : &timeout);
+	reactor->wakeup_cnt++;
+	if(ret <= 0)
+		return ret;
+	//snapshot ready entries first since callbacks may add or remove entries
+	for(i = 0; i < RTSP_REACTOR_MAX_FD; i++)
+	{
+		if(reactor->entry[i].fd >= 0 && FD_ISSET(reactor->entry[i].fd, &read_fds))
+		{
+			idx_list[ready] = i;
+			gen_list[ready] = reactor->entry[i].gen;
+			ev_list[ready++] = REACTOR_EV_READ;
+		}
+	}
+#elif (RTSP_REACTOR_BACKEND == RTSP_REACTOR_POLL)
+	struct pollfd pfd[RTSP_REACTOR_MAX_FD];
+	int pfd_idx[RTSP_REACTOR_MAX_FD];
+	int nfds = 0;
+	for(i = 0; i < RTSP_REACTOR_MAX_FD; i++)
+	{
+		if(reactor->entry[i].fd < 0)
+			continue;
+		pfd_idx[nfds] = i;
+		pfd[nfds].fd = reactor->entry[i].fd;
+		pfd[nfds].events = POLLIN;
+		pfd[nfds++].revents = 0;
+	}
+	ret = poll(pfd, nfds, timeout_ms);
+	reactor->wakeup_cnt++;
+	if(ret <= 0)
+		return ret;
+	for(i = 0; i < nfds; i++)
+	{
+		if(pfd[i].revents == 0)
+			continue;
+		idx_list[ready] = pfd_idx[i];
+		gen_list[ready] = reactor->entry[pfd_idx[i]].gen;
+		ev_list[ready++] = (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) ? (REACTOR_EV_READ | REACTOR_EV_ERROR) : REACTOR_EV_READ;
+	}
+#elif (RTSP_REACTOR_BACKEND == RTSP_REACTOR_EPOLL)
+	struct epoll_event ev[RTSP_REACTOR_MAX_FD];
+	ret = epoll_wait(reactor->backend_fd, ev, RTSP_REACTOR_MAX_FD, timeout_ms);
+	reactor->wakeup_cnt++;
+	if(ret <= 0)
+		return ret;
+	for(i = 0; i < ret; i++)
+	{
+		idx_list[ready] = (int)(ev[i].data.u64 & 0xffffffff);
+		gen_list[ready] = (u32)(ev[i].data.u64 >> 32);
+		ev_list[ready++] = (ev[i].events & (EPOLLERR | EPOLLHUP)) ? (REACTOR_EV_READ | REACTOR_EV_ERROR) : REACTOR_EV_READ;
+	}
+#endif
+	for(i = 0; i < ready; i++)
+		rtsp_reactor_dispatch(reactor, idx_list[i], gen_list[i], ev_list[i]);
+	return ready;
+}
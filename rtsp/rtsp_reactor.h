@@ -0,0 +1,64 @@
+#ifndef _RTSP_REACTOR_H_
+#define _RTSP_REACTOR_H_
+
+/*****************************************************INCLUDE**************************************************/
+#include "basic_types.h"
+#include "osdep_service.h"
+
+/*****************************************************DEFINITIONS**********************************************/
+
+/* reactor backend list */
+#define RTSP_REACTOR_SELECT	0	//default for lwIP
+#define RTSP_REACTOR_POLL	1
+#define RTSP_REACTOR_EPOLL	2
+
+#ifndef RTSP_REACTOR_BACKEND
+#if defined(__linux__)
+#define RTSP_REACTOR_BACKEND	RTSP_REACTOR_EPOLL
+#else
+#define RTSP_REACTOR_BACKEND	RTSP_REACTOR_SELECT
+#endif
+#endif
+
+#define RTSP_REACTOR_MAX_FD	48	//listen socket + control sockets + rtcp sockets + wakeup socket
+#define RTSP_REACTOR_TICK_MS	1000	//housekeeping interval when no event arrives
+
+/* readiness event flags */
+#define REACTOR_EV_READ		0x01
+#define REACTOR_EV_ERROR	0x02
+
+/*****************************************************STRUCTURES***********************************************/
+
+typedef void (*rtsp_reactor_cb)(int fd, int events, void *ctx);
+
+struct rtsp_reactor_entry
+{
+	int fd; //-1 if slot is free
+	u8 events;
+	u32 gen; //changes on every add, so a reused fd number is not taken for the old socket
+	rtsp_reactor_cb cb;
+	void *ctx;
+};
+
+struct rtsp_reactor
+{
+	struct rtsp_reactor_entry entry[RTSP_REACTOR_MAX_FD];
+	int entry_cnt;
+	u32 gen_seq;
+	int backend_fd; //epoll instance, unused by other backends
+	int wake_fd; //loopback datagram socket other tasks kick, -1 if the stack has no loopback
+	u16 wake_port; //in network order
+	u32 dispatch_cnt; //callbacks dispatched, for idle cpu tuning
+	u32 wakeup_cnt; //wait calls returned
+};
+
+/*****************************************************DECLARATIONS*********************************************/
+
+int rtsp_reactor_init(struct rtsp_reactor *reactor);
+void rtsp_reactor_deinit(struct rtsp_reactor *reactor);
+int rtsp_reactor_add(struct rtsp_reactor *reactor, int fd, int events, rtsp_reactor_cb cb, void *ctx);
+void rtsp_reactor_del(struct rtsp_reactor *reactor, int fd);
+int rtsp_reactor_run_once(struct rtsp_reactor *reactor, int timeout_ms);
+void rtsp_reactor_wakeup(struct rtsp_reactor *reactor);
+
+#endif
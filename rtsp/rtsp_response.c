@@ -0,0 +1,215 @@
+#include "platform/platform_stdlib.h"
+#include "osdep_service.h"
+#include "rtsp_rtp_dbg.h"
+#include "sockets.h" //for write/writev
+#include "lwip/init.h" //for LWIP_VERSION_MAJOR
+#include "rtsp_parser.h" //for header table
+#include "rtsp_response.h"
+
+static const u8 rtsp_hex_digit[] = "0123456789abcdef";
+
+//decimal without leading zeros, return length, buf needs 10 bytes
+int rtsp_fmt_u32(u8 *buf, u32 v)
+{
+	u8 tmp[10];
+	int i = 0, len;
+	do {
+		tmp[i++] = '0' + v % 10;
+		v /= 10;
+	}while(v != 0);
+	for(len = 0; i > 0; len++)
+		buf[len] = tmp[--i];
+	return len;
+}
+
+//lower case hex without leading zeros like %x, return length, buf needs 8 bytes
+int rtsp_fmt_hex(u8 *buf, u32 v)
+{
+	int shift = 28, len = 0;
+	while(shift > 0 && ((v >> shift) & 0xf) == 0)
+		shift -= 4;
+	for(; shift >= 0; shift -= 4)
+		buf[len++] = rtsp_hex_digit[(v >> shift) & 0xf];
+	return len;
+}
+
+void rtsp_res_init(struct rtsp_response *r)
+{
+	r->seg_cnt = 0;
+	r->len = 0;
+	r->scratch_len = 0;
+	r->err = 0;
+}
+
+void rtsp_res_add(struct rtsp_response *r, const void *ptr, int len)
+{
+	struct rtsp_res_seg *last;
+	if(len <= 0)
+		return;
+	//formatted fields written back to back in scratch stay one segment
+	if(r->seg_cnt > 0)
+	{
+		last = &r->seg[r->seg_cnt - 1];
+		if(last->ptr + last->len == (const u8 *)ptr)
+		{
+			last->len += len;
+			r->len += len;
+			return;
+		}
+	}
+	if(r->seg_cnt >= RTSP_RES_SEG_MAX)
+	{
+		r->err = -ENOMEM;
+		return;
+	}
+	r->seg[r->seg_cnt].ptr = (const u8 *)ptr;
+	r->seg[r->seg_cnt++].len = len;
+	r->len += len;
+}
+
+void rtsp_res_add_str(struct rtsp_response *r, const char *s)
+{
+	rtsp_res_add(r, s, strlen(s));
+}
+
+//reserve scratch room, NULL sets the error flag
+static u8 *rtsp_res_scratch(struct rtsp_response *r, int room)
+{
+	if(r->scratch_len + room > RTSP_RES_SCRATCH_SIZE)
+	{
+		r->err = -ENOMEM;
+		return NULL;
+	}
+	return r->scratch + r->scratch_len;
+}
+
+void rtsp_res_add_u32(struct rtsp_response *r, u32 v)
+{
+	u8 *p = rtsp_res_scratch(r, 10);
+	int len;
+	if(p == NULL)
+		return;
+	len = rtsp_fmt_u32(p, v);
+	r->scratch_len += len;
+	rtsp_res_add(r, p, len);
+}
+
+void rtsp_res_add_hex(struct rtsp_response *r, u32 v)
+{
+	u8 *p = rtsp_res_scratch(r, 8);
+	int len;
+	if(p == NULL)
+		return;
+	len = rtsp_fmt_hex(p, v);
+	r->scratch_len += len;
+	rtsp_res_add(r, p, len);
+}
+
+//dotted quad of address in network order
+void rtsp_res_add_ip(struct rtsp_response *r, const u8 *ip)
+{
+	u8 *p = rtsp_res_scratch(r, 15);
+	int i, len = 0;
+	if(p == NULL)
+		return;
+	for(i = 0; i < 4; i++)
+	{
+		if(i > 0)
+			p[len++] = '.';
+		len += rtsp_fmt_u32(p + len, ip[i]);
+	}
+	r->scratch_len += len;
+	rtsp_res_add(r, p, len);
+}
+
+//header name by RTSP_HDR_* id from the table the parser uses, followed by ": "
+void rtsp_res_add_hdr(struct rtsp_response *r, int id)
+{
+	const char *name = rtsp_keyword_name(&rtsp_header_table, id);
+	if(name == NULL)
+	{
+		r->err = -EINVAL;
+		return;
+	}
+	rtsp_res_add_str(r, name);
+	rtsp_res_add_lit(r, ": ");
+}
+
+#if !RTSP_RES_WRITEV
+static int rtsp_res_write(int fd, const u8 *buf, int len)
+{
+	int ret, off = 0;
+	while(off < len)
+	{
+		ret = write(fd, buf + off, len - off);
+		if(ret <= 0)
+			return -EIO;
+		off += ret;
+	}
+	return off;
+}
+#endif
+
+//write whole response to fd, return bytes sent or negative value
+int rtsp_res_send(struct rtsp_response *r, int fd)
+{
+	int i, sent = 0;
+#if RTSP_RES_WRITEV
+	struct iovec iov[RTSP_RES_SEG_MAX];
+	int ret, first = 0;
+#else
+	u8 buf[RTSP_RES_COPY_SIZE];
+	int fill = 0, pos, n;
+#endif
+	if(r->err < 0)
+	{
+		RTSP_ERROR("\n\rresponse does not fit");
+		return r->err;
+	}
+#if RTSP_RES_WRITEV
+	for(i = 0; i < r->seg_cnt; i++)
+	{
+		iov[i].iov_base = (void *)r->seg[i].ptr;
+		iov[i].iov_len = r->seg[i].len;
+	}
+	while(sent < r->len)
+	{
+		ret = writev(fd, &iov[first], r->seg_cnt - first);
+		if(ret <= 0)
+			return -EIO;
+		sent += ret;
+		//skip what went out, a short write leaves the rest of one segment
+		while(first < r->seg_cnt && ret >= (int)iov[first].iov_len)
+			ret -= iov[first++].iov_len;
+		if(first < r->seg_cnt)
+		{
+			iov[first].iov_base = (u8 *)iov[first].iov_base + ret;
+			iov[first].iov_len -= ret;
+		}
+	}
+#else
+	//one write per response, tcp_nodelay would otherwise turn every segment into a packet
+	for(i = 0; i < r->seg_cnt; i++)
+	{
+		for(pos = 0; pos < r->seg[i].len; pos += n)
+		{
+			if(fill == RTSP_RES_COPY_SIZE)
+			{
+				if(rtsp_res_write(fd, buf, fill) < 0)
+					return -EIO;
+				sent += fill;
+				fill = 0;
+			}
+			n = r->seg[i].len - pos;
+			if(n > RTSP_RES_COPY_SIZE - fill)
+				n = RTSP_RES_COPY_SIZE - fill;
+			memcpy(buf + fill, r->seg[i].ptr + pos, n);
+			fill += n;
+		}
+	}
+	if(rtsp_res_write(fd, buf, fill) < 0)
+		return -EIO;
+	sent += fill;
+#endif
+	return sent;
+}
@@ -0,0 +1,63 @@
+#ifndef _RTSP_RESPONSE_H_
+#define _RTSP_RESPONSE_H_
+
+/*****************************************************INCLUDE**************************************************/
+#include "basic_types.h"
+#include "osdep_service.h"
+
+/*****************************************************DEFINITIONS**********************************************/
+
+//responses go out with one writev where the stack has it (linux, lwIP 2.x lwip_writev),
+//otherwise segments are gathered into RTSP_RES_COPY_SIZE on stack and written at once
+#ifndef RTSP_RES_WRITEV
+#if defined(__linux__) || (defined(LWIP_VERSION_MAJOR) && (LWIP_VERSION_MAJOR >= 2))
+#define RTSP_RES_WRITEV		1
+#else
+#define RTSP_RES_WRITEV		0
+#endif
+#endif
+
+#define RTSP_RES_SEG_MAX	40	//constant slices + formatted fields of one response
+#define RTSP_RES_SCRATCH_SIZE	96	//room for formatted numbers and addresses
+#define RTSP_RES_COPY_SIZE	1024	//gather buffer without writev, larger responses go out in full chunks
+
+/*****************************************************STRUCTURES***********************************************/
+
+struct rtsp_res_seg
+{
+	const u8 *ptr;
+	int len;
+};
+
+/*
+ * Response under construction. Constant parts (status line, header names,
+ * SDP body) are referenced in place, only numbers are formatted into the
+ * small scratch area. Adjacent formatted fields share one segment.
+ */
+struct rtsp_response
+{
+	struct rtsp_res_seg seg[RTSP_RES_SEG_MAX];
+	int seg_cnt;
+	int len; //total bytes
+	u8 scratch[RTSP_RES_SCRATCH_SIZE];
+	int scratch_len;
+	int err; //set once something did not fit, response is not sent
+};
+
+/*****************************************************DECLARATIONS*********************************************/
+
+void rtsp_res_init(struct rtsp_response *r);
+void rtsp_res_add(struct rtsp_response *r, const void *ptr, int len);
+void rtsp_res_add_str(struct rtsp_response *r, const char *s);
+void rtsp_res_add_u32(struct rtsp_response *r, u32 v);
+void rtsp_res_add_hex(struct rtsp_response *r, u32 v);
+void rtsp_res_add_ip(struct rtsp_response *r, const u8 *ip);
+void rtsp_res_add_hdr(struct rtsp_response *r, int id);
+int rtsp_res_send(struct rtsp_response *r, int fd);
+int rtsp_fmt_u32(u8 *buf, u32 v);
+int rtsp_fmt_hex(u8 *buf, u32 v);
+
+//constant slice of a string literal, length known at compile time
+#define rtsp_res_add_lit(r, lit)	rtsp_res_add((r), (lit), sizeof(lit) - 1)
+
+#endif
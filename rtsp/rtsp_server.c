@@ -5,29 +5,28 @@
 #include "rtsp_rtp_dbg.h"
 #include "rtsp_common.h"
 #include "rtsp_server.h"
+#include "rtcp_api.h"
 
 #include "sockets.h" //for sockets
 #include "wifi_conf.h"
 #include "wifi_util.h" //for getting wifi mode info
 #include "lwip/netif.h" //for LwIP_GetIP
 
-#define RTSP_IP_SIZE	4
-
 #define RTSP_SERVICE_PRIORITY   2
 #define RTP_SERVICE_PRIORITY    (RTSP_SERVICE_PRIORITY - 1)
+#define RTP_SERVICE_STACK_SIZE  1024 //in words, packet buffers come from sink pool instead of task stack
+#define RTP_WORKER_EXIT_TIMEOUT 2000 //in ms, covers a paused sender noticing the stop
 
 extern struct netif xnetif[NET_IF_NUM];
 extern uint8_t* LwIP_GetIP(struct netif *pnetif);
 
 static u32 rtsp_launch_timeout = 60000; //in ms
 
-static u8 lower_port_bitmap = 0;
-static _mutex lower_port_lock = NULL;
-static u8 client_lower_port_bitmap = 0;
-static _mutex client_lower_port_lock = NULL;
-static u8 server_lower_port_bitmap = 0;
-static _mutex server_lower_port_lock = NULL;
-static atomic_t lock_ref_cnt = {0};
+//port pairs are shared by all server instances, set up by the first one
+static struct rtp_port_range mcast_port_range;
+static struct rtp_port_range client_port_range;
+static struct rtp_port_range server_port_range;
+static atomic_t port_ref_cnt = {0};
 
 //for debug purpose only
 #if 1
@@ -58,334 +57,120 @@ void rtsp_transport_dump(struct rtsp_transport *transport)
 }
 #endif
 
-//this range param should be aligned with port bitmap type size
-static int rtsp_get_port(int base, int range, u8* bitmap)
+//parse "a-b" style pair of a transport parameter
+static void rtsp_parse_pair(struct rtsp_str *val, u16 *first, u16 *second)
 {
-	int find = -1;
-        int i, tmp;
-        tmp = *bitmap;
-	for(i = 0; i < range; i += 2)
-	{
-		if(!((tmp>>i)&1))
-		{
-			//set bit
-			find = base + i;
-			*bitmap |= (1 << i);
-			break;
-		}
-	}
-	return find;
+		struct rtsp_str token;
+		if(rtsp_str_split(val, '-', &token))
+			*first = rtsp_str_to_u32(&token, 10);
+		if(rtsp_str_split(val, '-', &token))
+			*second = rtsp_str_to_u32(&token, 10);
 }
 
-static void rtsp_put_port(int base, int range, u8* bitmap, int port)
+static void rtsp_parse_transport(struct rtsp_transport *transport, struct rtsp_str *field)
 {
-        int tmp = *bitmap;
-	int bit = (port - base)/2;
-	if((tmp>>bit)&1)
-	{
-		//clear bit
-		*bitmap &= !(1 << bit);
-	}
-}
-
-static u8* rtsp_parse_header_line(struct rtsp_message *msg, u8 *header, int *size_left)
-{
-		u8 *p_start, *p_tmp, *p_end;
-		u8 offset = 0;
-		int parse_item = 0;
-		u8 b_tmp[16];
-		p_start = p_tmp = p_end = header;
-
-		while(!is_line_end(p_end) && offset <= *size_left)
-		{
-			if(*p_end == ' ' || *p_end == '\r')
-			{
-				memset(b_tmp, 0, 16);
-				if(parse_item == 0)//parse method
-				{
-					parse_item++;
-					memcpy(b_tmp, p_tmp, p_end-p_tmp);
-					b_tmp[p_end-p_tmp] = '\0';
-					if(!strcmp(b_tmp, "OPTIONS"))
-					{
-						msg->method = RTSP_REQ_OPTIONS;
-					}else if(!strcmp(b_tmp, "DESCRIBE"))
-						{
-							msg->method = RTSP_REQ_DESCRIBE;
-						}else if(!strcmp(b_tmp, "SETUP"))
-							{
-								msg->method = RTSP_REQ_SETUP;
-							}else if(!strcmp(b_tmp, "TEARDOWN"))
-								{
-									msg->method = RTSP_REQ_TEARDOWN;
-								}else if(!strcmp(b_tmp, "PLAY"))
-									{
-										msg->method = RTSP_REQ_PLAY;
-									}else if(!strcmp(b_tmp, "PAUSE"))
-										{
-											msg->method = RTSP_REQ_PAUSE;
-										}else if(!strcmp(b_tmp, "GET_PARAMETER"))
-											{
-												msg->method = RTSP_REQ_GET_PARAMETER;
-											}else{
-													msg->method = RTSP_REQ_UNDEFINED;
-												}				
-				}else if(parse_item == 1)//parse request uri
-					{
-						parse_item++;
-						//to do
-					}else if(parse_item == 2)//parse rtsp version
-						{
-							parse_item++;
-							//ignore
-						}
-				p_tmp = p_end + 1;//move to next item
-			}
-			p_end++;
-			offset++;
-		}
-		if(*p_end == '\n')
-		{
-			//copy request line without CRLF
-			if(p_end-p_start-1 < REQ_LINE_BUF_SIZE)
-			{
-				memcpy(msg->request_line, p_start, p_end-p_start-1);
-				msg->request_line[p_end-p_start] = '\0';
-			}
-			else
-			{
-				memcpy(msg->request_line, p_start, REQ_LINE_BUF_SIZE - 1);
-				msg->request_line[REQ_LINE_BUF_SIZE - 1] = '\0';
-			}
-			//skip CRLF
-			p_end += 1;
-			offset += 1;
-			*size_left -= offset;
-			return p_end;
-		}else{
-			//fall into error
-			*size_left = 0;
-			return NULL;
-			}
-}
-
-static u8* rtsp_parse_body_line(struct rtsp_message *msg, u8 *body, int *size_left)
-{
-		u8 *p_start, *p_tmp, *p_end, *token;
-		u8 offset = 0;
-		int parse_item = 0;
-		char delimeter [] = "/=-";
-		u8 b_tmp[64] = {0};
-		p_start = p_tmp = p_end = body;
-		while(!is_line_end(p_end) && offset <= *size_left)
+		struct rtsp_str param, key, spec;
+		//transport specifier <transport/profile/lower-transport>, default is RTP/AVP/UDP
+		if(!rtsp_str_split(field, ';', &param))
+			return;
+		rtsp_str_split(&param, '/', &spec);
+		transport->proto = rtsp_str_eq(&spec, "RTP") ? TRANS_PROTO_RTP : TRANS_PROTO_UNKNOWN;
+		rtsp_str_split(&param, '/', &spec); //AVP
+		if(!rtsp_str_split(&param, '/', &spec) || rtsp_str_eq(&spec, "UDP"))
+			transport->lower_proto = TRANS_LOWER_PROTO_UDP;
+		else if(rtsp_str_eq(&spec, "TCP"))
+			transport->lower_proto = TRANS_LOWER_PROTO_TCP;
+		else
+			transport->lower_proto = TRANS_LOWER_PROTO_UNKNOWN;
+		while(rtsp_str_split(field, ';', &param))
 		{
-			//parse header field type
-			if(*p_end == ':')
+			u16 even = 0, odd = 0;
+			rtsp_str_trim(&param);
+			rtsp_str_split(&param, '=', &key);
+			switch(rtsp_keyword_lookup(&rtsp_transport_table, &key))
 			{
-				//sanity check
-				if(*(p_end + 1) == ' ')
-				{
-					memcpy(b_tmp, p_tmp, p_end - p_tmp);
-					b_tmp[p_end - p_tmp] = '\0';
-					p_end = p_end + 2; //skip colon ':' and space ' '
-					offset += 2;
-					p_tmp = p_end;
+				case(RTSP_TP_UNICAST):
+					transport->cast_mode = UNICAST_MODE;
 					break;
-				}
-			}	
-			p_end++;
-			offset++;
-		}
-		
-		if(!strncmp(b_tmp, "CSeq", 4))
-		{
-			memset(b_tmp, 0, 64);
-			while(!is_line_end(p_end) && offset <= *size_left)
-			{
-				if(*p_end == '\r')
-				{
-					memcpy(b_tmp, p_tmp, p_end - p_tmp);
-					b_tmp[p_end - p_tmp] = '\0';
-					msg->CSeq = atoi(b_tmp);
+				case(RTSP_TP_MULTICAST):
+					transport->cast_mode = MULTICAST_MODE;
+					break;
+				case(RTSP_TP_INTERLEAVED):
+					rtsp_parse_pair(&param, &even, &odd);
+					transport->interleaved_even = even;
+					transport->interleaved_odd = odd;
+					break;
+				case(RTSP_TP_TTL):
+					transport->ttl = rtsp_str_to_u32(&param, 10);
+					break;
+				case(RTSP_TP_CLIENT_PORT):
+					rtsp_parse_pair(&param, &transport->client_port_even, &transport->client_port_odd);
+					break;
+				case(RTSP_TP_PORT):
+					rtsp_parse_pair(&param, &transport->port_even, &transport->port_odd);
+					break;
+				case(RTSP_TP_SERVER_PORT):
+					rtsp_parse_pair(&param, &transport->server_port_even, &transport->server_port_odd);
+					break;
+				case(RTSP_TP_SSRC):
+					transport->ssrc = rtsp_str_to_u32(&param, 16);
+					break;
+				default:
+					//destination, append, source, layers and mode are not supported, RECORD is never accepted
 					break;
-				}
-				p_end++;
-				offset++;
-			}
-		}else if(!strncmp(b_tmp, "Transport", 9))
-			{
-				while(!is_line_end(p_end) && offset <= *size_left)
-				{
-					if(*p_end == ';'||*p_end == '\r')
-					{	
-						if(parse_item == 0)
-						{
-						//parse transport specifier <transport/profile/lower-transport>, default is RTP/AVP/XXX
-							parse_item++;
-							memset(b_tmp, 0, 64);
-							memcpy(b_tmp, p_tmp, p_end - p_tmp);
-							b_tmp[p_end - p_tmp] = '\0';
-							token = strtok(b_tmp, delimeter);//get RTP
-							if(!strncmp(token, "RTP", 3))
-								msg->transport.proto = TRANS_PROTO_RTP;
-							else
-								msg->transport.proto = TRANS_PROTO_UNKNOWN;
-							token = strtok(NULL, delimeter);//get AVP
-							token = strtok(NULL, delimeter);//get lower-transport
-							if(token == NULL || !strncmp(token, "UDP", 3))
-							{
-								msg->transport.lower_proto = TRANS_LOWER_PROTO_UDP;
-							}else if(!strncmp(token, "TCP", 3)){
-								msg->transport.lower_proto = TRANS_LOWER_PROTO_TCP;
-							}else
-							{
-								msg->transport.lower_proto = TRANS_LOWER_PROTO_UNKNOWN;
-							}
-						}else{
-							memset(b_tmp, 0, 64);
-							memcpy(b_tmp, p_tmp, p_end - p_tmp);
-							b_tmp[p_end - p_tmp] = '\0';
-							if(!strncmp(b_tmp, "unicast", 7))
-								msg->transport.cast_mode = UNICAST_MODE;
-							else if(!strncmp(b_tmp, "multicast", 9))
-								msg->transport.cast_mode = MULTICAST_MODE;
-/*							
-							else if(!strncmp(b_tmp, "destination", 11))
-								//to do
-							else if(!strncmp(b_tmp, "interleaved", 11))
-								//to do
-							else if(!strncmp(b_tmp, "append", 6))
-								//to do
-							else if(!strncmp(b_tmp, "ttl", 3))
-								//to do
-							else if(!strncmp(b_tmp, "port", 4))
-								//to do
-*/
-							else if(!strncmp(b_tmp, "client_port", 11))
-							{
-								memset(b_tmp, 0, 64);
-								memcpy(b_tmp, p_tmp, p_end - p_tmp);
-								b_tmp[p_end - p_tmp] = '\0';	
-								token = strtok(b_tmp, delimeter); //get "client_port"
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.client_port_even = atoi(token);
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.client_port_odd = atoi(token);
-							}
-							else if(!strncmp(b_tmp, "port", 4))
-							{
-								memset(b_tmp, 0, 64);
-								memcpy(b_tmp, p_tmp, p_end - p_tmp);
-								b_tmp[p_end - p_tmp] = '\0';	
-								token = strtok(b_tmp, delimeter); //get "client_port"
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.port_even = atoi(token);
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.port_odd = atoi(token);								
-							}
-							else if(!strncmp(b_tmp, "server_port", 11))
-							{
-								memset(b_tmp, 0, 64);
-								memcpy(b_tmp, p_tmp, p_end - p_tmp);
-								b_tmp[p_end - p_tmp] = '\0';	
-								token = strtok(b_tmp, delimeter); //get "server_port"
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.server_port_even = atoi(token);
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.server_port_odd = atoi(token);								
-							}
-							else if(!strncmp(b_tmp, "ssrc", 4))
-							{
-								memset(b_tmp, 0, 64);
-								memcpy(b_tmp, p_tmp, p_end - p_tmp);
-								b_tmp[p_end - p_tmp] = '\0';
-								token = strtok(b_tmp, delimeter); //get "ssrc"
-								token = strtok(NULL, delimeter);
-								if(token != NULL)
-									msg->transport.ssrc = atoi(token);
-							}
-/*  valid value are PLAY and RECORD but we don't support RECORD							
-							else if(!strncmp(b_tmp, "mode", 4))
-								//to do
-*/							
-						}
-						
-						if(*p_end == ';')
-						{
-							p_end++;
-							offset++;
-							p_tmp = p_end;//skip ';'
-						}else if(*p_end == '\r')
-						{
-							break;
-						}
-					}else{
-						p_end++;
-						offset++;
-					}
-				}
 			}
-                while(!is_line_end(p_end) && offset <= *size_left)
-                {
-                        p_end ++;
-                        offset ++;
-                }
-
-		if(*p_end == '\n')
-		{
-			//skip CRLF
-			p_end += 1;
-			offset += 1;
-			*size_left -= offset;
-			return p_end;
-		}else{
-                        printf("\n\rparsing line error");
-			*size_left = 0;
-			return NULL;
 		}
 }
 
-int rtsp_parse_request(struct rtsp_message *msg, u8 *request, int size)
+//fill message from the views of a request the connection parser just completed
+int rtsp_parse_request(struct rtsp_message *msg, struct rtsp_parser *p)
 {
-                u8 *p_start, *p_body;
-		p_start = p_body = NULL;
-		int size_left = size;
-                msg->method = RTSP_REQ_UNDEFINED;
-		//is it a rtsp request?
-		if(request == NULL || *request == '\0' || size <= 0)
-		{
-			//RTSP_WARN("\n\rinvalid request - (NULL request)");
-			return -EAGAIN;
-		}
-		p_body = rtsp_parse_header_line(msg, request, &size_left);
+		struct rtsp_str *field;
+		int len;
+		if((msg->method = rtsp_keyword_lookup(&rtsp_method_table, &p->method)) < 0)
+			msg->method = RTSP_REQ_UNDEFINED;
+		msg->session_id = 0;
+		msg->CSeq = 0;
+		msg->content_length = p->content_length;
+		memset(&msg->transport, 0, sizeof(struct rtsp_transport));
+		//keep request line for logging
+		len = p->version.ptr + p->version.len - p->method.ptr;
+		if(len > REQ_LINE_BUF_SIZE - 1)
+			len = REQ_LINE_BUF_SIZE - 1;
+		memcpy(msg->request_line, p->method.ptr, len);
+		msg->request_line[len] = '\0';
 		if(msg->method == RTSP_REQ_UNDEFINED)
 		{
 			RTSP_WARN("\n\rinvalid request - (UNDEFINED request)");
 			return -EINVAL;
-		}			
-		while(p_body != NULL && *p_body != '\0' && size_left > 0)
+		}
+		if((field = rtsp_parser_header(p, RTSP_HDR_CSEQ)) != NULL)
+			msg->CSeq = rtsp_str_to_u32(field, 10);
+		if((field = rtsp_parser_header(p, RTSP_HDR_SESSION)) != NULL)
+			msg->session_id = rtsp_str_to_u32(field, 16);
+		if((field = rtsp_parser_header(p, RTSP_HDR_TRANSPORT)) != NULL)
 		{
-                        //printf("\n\rline:%c size left:%d", *p_body, size_left);
-			p_body = rtsp_parse_body_line(msg, p_body, &size_left);
+			struct rtsp_str value = *field;
+			rtsp_parse_transport(&msg->transport, &value);
 		}
 		return 0;
 }
 
 /* rtsp server media session */
 void rtsp_set_rtp_task(rtsp_sm_subsession *subsession, void (*rtp_task_handle)(void *ctx));
+static int rtsp_server_stop_workers(struct rtsp_server *server, int timeout_ms);
+static void rtsp_reaper_schedule(struct rtsp_reap_wheel *wheel, rtsp_client_conn *conn);
 
 void rtsp_sm_subsession_free(rtsp_sm_subsession *subsession)
 {
+		if(subsession == NULL)
+			return;
 		if(subsession->my_sdp != NULL)
 			free(subsession->my_sdp);
-		if(subsession != NULL)
-			free(subsession);
+		rtw_mutex_free(&subsession->client_lock);
+		rtw_mutex_free(&subsession->tx_lock);
+		rtw_free_sema(&subsession->state_sema);
+		free(subsession);
 }
 
 void rtsp_sm_session_free(rtsp_sm_session *session)
@@ -399,46 +184,228 @@ void rtsp_sm_session_free(rtsp_sm_session *session)
 		}	
 }
 
-void rtsp_sm_subsession_refresh(rtsp_sm_subsession *subsession)
+//the first viewer claims the shared pair whatever its transport, so a sender started for an interleaved
+//viewer is already bound to the port later udp viewers are told in server_port=, called under client lock
+static int rtsp_sm_subsession_get_server_port(rtsp_sm_subsession *subsession)
 {
-        rtsp_cc_session *c = &subsession->client;
-        struct rtsp_transport *transport = &c->transport;
-        if(c->is_handled)
+        int port;
+        if(subsession->server_port_even != 0)
+                return 0;
+        if((port = rtp_port_pair_get(&server_port_range)) < 0)
         {
-                c->client_socket = -1;
-                //client ip is inherited from rtsp server struct 
-                //so we dont need to free it here since it will be handled elsewhere
-                c->client_ip = NULL;
-                if(transport->client_port_even != 0)
-                {
-                        rtw_mutex_get(&client_lower_port_lock);
-                        rtsp_put_port(CLIENT_LOWER_PORT_BASE, 8, &client_lower_port_bitmap, transport->client_port_even);
-                        rtw_mutex_put(&client_lower_port_lock);                    
-                }
-                if(transport->server_port_even != 0)
-                {
-                        rtw_mutex_get(&server_lower_port_lock);
-                        rtsp_put_port(SERVER_LOWER_PORT_BASE, 8, &server_lower_port_bitmap, transport->server_port_even);
-                        rtw_mutex_put(&server_lower_port_lock);                 
-                }      
-                if(transport->port_even)
-                {
-                        rtw_mutex_get(&lower_port_lock);
-                        rtsp_put_port(LOWER_PORT_BASE, 8, &lower_port_bitmap, transport->port_even);
-                        rtw_mutex_put(&lower_port_lock);                 
-                }
-                memset(transport, 0, sizeof(struct rtsp_transport));
-                c->is_handled = 0;
+                RTSP_WARN("no server port pair left");
+                return port;
         }
-        subsession->task_id = NULL;
-        rtsp_set_rtp_task(subsession, NULL);
+        subsession->server_port_even = port;
+        subsession->server_port_odd = port + 1;
+        subsession->server_port_claimed = 1;
+        return 0;
 }
 
-void rtsp_sm_session_refresh(rtsp_sm_session *session)
+static void rtsp_sm_subsession_put_server_port(rtsp_sm_subsession *subsession)
+{
+        if(subsession->server_port_even != 0 && subsession->server_port_claimed)
+                rtp_port_pair_put(&server_port_range, subsession->server_port_even);
+        subsession->server_port_claimed = 0;
+        subsession->server_port_even = 0;
+        subsession->server_port_odd = 0;
+}
+
+static void rtsp_server_on_rtcp(int fd, int events, void *ctx)
 {
+        rtsp_sm_subsession *subsession = (rtsp_sm_subsession *)ctx;
+        u8 buf[RTCP_RECV_BUF_SIZE];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int ret = recvfrom(fd, buf, RTCP_RECV_BUF_SIZE, 0, (struct sockaddr *)&from, &from_len);
+        rtsp_cc_session *c = NULL;
+        //second octet of rtcp common header is packet type
+        if(ret < 8 || buf[1] != RTCP_TYPE_RR)
+                return;
+        subsession->rtcp_rr_cnt++;
+        //report proves the viewer it came from is still there
+        rtw_mutex_get(&subsession->client_lock);
+        list_for_each_entry(c, &subsession->client_list, bind_anchor, rtsp_cc_session)
+        {
+                if(c->client_ip != NULL && *(u32 *)c->client_ip == from.sin_addr.s_addr)
+                        rtsp_client_conn_touch((rtsp_client_conn *)c->parent_conn);
+        }
+        rtw_mutex_put(&subsession->client_lock);
+}
+
+//open rtcp socket on server odd port and hand it to reactor, called from server task only
+static int rtsp_sm_subsession_open_rtcp(rtsp_sm_subsession *subsession)
+{
+        p_rtsp_sm_session session = subsession->parent_session;
+        struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
+        struct sockaddr_in rtcp_addr;
+        int rtcp_socket;
+        if(subsession->rtcp_sock >= 0 || subsession->server_port_odd == 0)
+                return 0;
+        rtcp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if(rtcp_socket < 0)
+                return -EIO;
+        memset(&rtcp_addr, 0, sizeof(rtcp_addr));
+        rtcp_addr.sin_family = AF_INET;
+        rtcp_addr.sin_addr.s_addr = *(uint32_t *)(server->server_ip);
+        rtcp_addr.sin_port = _htons(subsession->server_port_odd);
+        if(bind(rtcp_socket, (struct sockaddr *)&rtcp_addr, sizeof(rtcp_addr)) < 0 ||
+           rtsp_reactor_add(&server->reactor, rtcp_socket, REACTOR_EV_READ, rtsp_server_on_rtcp, (void *)subsession) < 0)
+        {
+                RTSP_ERROR("rtcp socket setup failed");
+                close(rtcp_socket);
+                return -EIO;
+        }
+        subsession->rtcp_sock = rtcp_socket;
+        return 0;
+}
+
+static void rtsp_sm_subsession_close_rtcp(rtsp_sm_subsession *subsession)
+{
+        p_rtsp_sm_session session = subsession->parent_session;
         struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
+        if(subsession->rtcp_sock < 0)
+                return;
+        rtsp_reactor_del(&server->reactor, subsession->rtcp_sock);
+        close(subsession->rtcp_sock);
+        subsession->rtcp_sock = -1;
+}
+
+//group fixed by adapter config, known before any viewer joins
+//return 0 if groups are picked by the first viewer instead
+static int rtsp_sm_subsession_fixed_group(rtsp_sm_subsession *subsession, u32 *addr, u16 *port, u8 *ttl)
+{
+        p_rtsp_sm_session session = subsession->parent_session;
+        struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
+        rtsp_server_adapter *adapter = server->adapter;
+        u32 base = (adapter->mcast_addr != 0) ? adapter->mcast_addr : RTSP_MCAST_ADDR_DEF;
+        if(adapter->mcast_port == 0)
+                return 0;
+        *addr = _htonl(base + subsession->id);
+        *port = adapter->mcast_port + 2 * subsession->id;
+        *ttl = (adapter->mcast_ttl != 0) ? adapter->mcast_ttl : 1;
+        return 1;
+}
+
+//attach multicast binding to subsession group, the first one creates the group
+static void rtsp_sm_subsession_join_group(rtsp_sm_subsession *subsession, struct rtsp_transport *transport)
+{
+        p_rtsp_sm_session session = subsession->parent_session;
+        struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
+        u32 base = (server->adapter->mcast_addr != 0) ? server->adapter->mcast_addr : RTSP_MCAST_ADDR_DEF;
+        rtw_mutex_get(&subsession->client_lock);
+        if(subsession->mcast_cnt == 0 && rtsp_sm_subsession_fixed_group(subsession, &subsession->mcast_addr, &subsession->mcast_port_even, &subsession->mcast_ttl))
+        {
+                //group was advertised already, viewer gets it whatever it asked for
+                if(transport->port_claimed & RTSP_PORT_CLAIMED_MCAST)
+                        rtp_port_pair_put(&mcast_port_range, transport->port_even);
+                subsession->mcast_port_odd = subsession->mcast_port_even + 1;
+                subsession->mcast_port_claimed = 0;
+                subsession->mcast_ssrc = transport->ssrc;
+                rtw_get_random_bytes(&subsession->mcast_seq_no, sizeof(subsession->mcast_seq_no));
+                rtw_get_random_bytes(&subsession->mcast_ts_offset, sizeof(subsession->mcast_ts_offset));
+        }else if(subsession->mcast_cnt == 0)
+        {
+                //group takes the port pair and ttl the first viewer asked for
+                subsession->mcast_addr = _htonl(base + subsession->id);
+                subsession->mcast_port_even = transport->port_even;
+                subsession->mcast_port_odd = transport->port_odd;
+                subsession->mcast_port_claimed = (transport->port_claimed & RTSP_PORT_CLAIMED_MCAST) ? 1 : 0;
+                subsession->mcast_ttl = transport->ttl;
+                subsession->mcast_ssrc = transport->ssrc;
+                rtw_get_random_bytes(&subsession->mcast_seq_no, sizeof(subsession->mcast_seq_no));
+                rtw_get_random_bytes(&subsession->mcast_ts_offset, sizeof(subsession->mcast_ts_offset));
+                //advertise group in sdp of following DESCRIBE
+                rtsp_sm_session_sdp_changed(session);
+        }else if(transport->port_claimed & RTSP_PORT_CLAIMED_MCAST)
+        {
+                //later viewers just attach, give back the pair check_fix reserved for them
+                rtp_port_pair_put(&mcast_port_range, transport->port_even);
+        }
+        //group owns the pair from now on
+        transport->port_claimed &= ~RTSP_PORT_CLAIMED_MCAST;
+        transport->port_even = subsession->mcast_port_even;
+        transport->port_odd = subsession->mcast_port_odd;
+        transport->ttl = subsession->mcast_ttl;
+        transport->ssrc = subsession->mcast_ssrc;
+        subsession->mcast_cnt++;
+        rtw_mutex_put(&subsession->client_lock);
+}
+
+static void rtsp_sm_subsession_leave_group(rtsp_sm_subsession *subsession)
+{
+        p_rtsp_sm_session session = subsession->parent_session;
+        rtw_mutex_get(&subsession->client_lock);
+        if(subsession->mcast_cnt > 0 && --subsession->mcast_cnt == 0)
+        {
+                if(subsession->mcast_port_claimed)
+                        rtp_port_pair_put(&mcast_port_range, subsession->mcast_port_even);
+                subsession->mcast_port_claimed = 0;
+                subsession->mcast_addr = 0;
+                subsession->mcast_port_even = 0;
+                subsession->mcast_port_odd = 0;
+                rtsp_sm_session_sdp_changed(session);
+        }
+        rtw_mutex_put(&subsession->client_lock);
+}
+
+//attach client binding to subsession, rtp task of subsession will start feeding it
+static void rtsp_sm_subsession_bind(rtsp_sm_subsession *subsession, rtsp_cc_session *c)
+{
+        rtw_mutex_get(&subsession->client_lock);
+        list_add_tail(&c->bind_anchor, &subsession->client_list);
+        subsession->client_cnt++;
+        rtw_mutex_put(&subsession->client_lock);
+}
+
+//detach client binding and release its resources, waits for a fan-out in progress to let go of the binding
+static void rtsp_sm_subsession_unbind(rtsp_sm_subsession *subsession, rtsp_cc_session *c)
+{
+        struct rtsp_transport *transport = &c->transport;
+        if(!c->is_handled)
+                return;
+        rtw_mutex_get(&subsession->tx_lock);
+        rtw_mutex_get(&subsession->client_lock);
+        list_del_init(&c->bind_anchor);
+        subsession->client_cnt--;
+        if(c->is_playing)
+                subsession->play_cnt--;
+        c->is_playing = 0;
+        //the last viewer gone, give back the shared server port pair
+        if(subsession->client_cnt == 0 && !subsession->is_running)
+                rtsp_sm_subsession_put_server_port(subsession);
+        rtw_mutex_put(&subsession->client_lock);
+        if(subsession->client_cnt == 0)
+                rtsp_sm_subsession_close_rtcp(subsession);
+        c->client_socket = -1;
+        if(c->tcp_buf != NULL)
+                free(c->tcp_buf);
+        c->tcp_buf = NULL;
+        c->tcp_buf_len = 0;
+        c->tcp_stall_time = 0;
+        //client ip is inherited from rtsp connection struct
+        //so we dont need to free it here since it will be handled elsewhere
+        c->client_ip = NULL;
+        if(transport->port_claimed & RTSP_PORT_CLAIMED_CLIENT)
+                rtp_port_pair_put(&client_port_range, transport->client_port_even);
+        if(transport->cast_mode == MULTICAST_MODE)
+                rtsp_sm_subsession_leave_group(subsession);
+        memset(transport, 0, sizeof(struct rtsp_transport));
+        c->is_handled = 0;
+        rtw_mutex_put(&subsession->tx_lock);
+        //let sender notice a viewer left
+        rtw_up_sema(&subsession->state_sema);
+        rtp_sink_wakeup(subsession->sink);
+}
+
+int rtsp_cc_session_is_playing(rtsp_cc_session *c)
+{
+        return c->is_playing;
+}
+
+void rtsp_sm_session_refresh(rtsp_sm_session *session)
+{
         struct rtsp_session_info *s = &session->session_info;
-        rtsp_sm_subsession *subsession = NULL;
 	if(s->user != NULL)
 		free(s->user);
 	if(s->name != NULL)
@@ -446,10 +413,6 @@ void rtsp_sm_session_refresh(rtsp_sm_session *session)
 	if(s->info != NULL)
 		free(s->info); 
         memset(s, 0, sizeof(struct rtsp_session_info));
-	list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
-	{        
-                rtsp_sm_subsession_refresh(subsession);
-        }
 }
 
 rtsp_sm_subsession * rtsp_sm_subsession_create(rtp_source_t *src, rtp_sink_t *sink, int max_sdp_size)
@@ -470,6 +433,13 @@ rtsp_sm_subsession * rtsp_sm_subsession_create(rtp_source_t *src, rtp_sink_t *si
 		subsession->my_sdp_max_len = max_sdp_size;
 		subsession->my_sdp_content_len = 0;
 		INIT_LIST_HEAD(&subsession->media_anchor);
+		INIT_LIST_HEAD(&subsession->client_list);
+		INIT_LIST_HEAD(&subsession->work_anchor);
+		rtw_mutex_init(&subsession->client_lock);
+		rtw_mutex_init(&subsession->tx_lock);
+		rtw_init_sema(&subsession->state_sema, 0);
+		subsession->sender_state = RTP_SENDER_IDLE;
+		subsession->rtcp_sock = -1;
 		if(sink != NULL)
 			subsession->sink = sink;
 		if(src != NULL)
@@ -489,14 +459,42 @@ int rtsp_sm_subsession_add(rtsp_sm_session *session, rtsp_sm_subsession *subsess
 		subsession->id = ATOMIC_READ(&session->subsession_cnt);
 		list_add_tail(&subsession->media_anchor, &session->media_entry);
 		subsession->parent_session = (void *)session;
+		//parameters fixed at sink setup go to fmtp once, packetizer republishes only if they changed
+		if(subsession->sink != NULL && subsession->sink->codec_id == AV_CODEC_ID_MP4A_LATM)
+			aac_fmtp_config(subsession->sink->frequency, subsession->sink->nb_channels, subsession->fmtp, RTSP_FMTP_MAX);
                 ATOMIC_INC(&session->subsession_cnt);
+		rtsp_sm_session_sdp_changed(session);
 		return 0;
 }
 
+//invalidate cached sdp, call after changing codec parameters of a sink
+void rtsp_sm_session_sdp_changed(rtsp_sm_session *session)
+{
+		ATOMIC_INC(&session->sdp_version);
+}
+
+//codec parameters found in stream, cached sdp is invalidated only when they differ from the advertised ones
+//return 1 if changed, 0 if same
+int rtsp_sm_subsession_set_fmtp(rtsp_sm_subsession *subsession, const char *fmtp)
+{
+		int changed;
+		if(strlen(fmtp) >= RTSP_FMTP_MAX)
+			return -EINVAL;
+		rtw_mutex_get(&subsession->client_lock);
+		changed = (strcmp(subsession->fmtp, fmtp) != 0);
+		if(changed)
+			strcpy(subsession->fmtp, fmtp);
+		rtw_mutex_put(&subsession->client_lock);
+		if(changed && subsession->parent_session != NULL)
+			rtsp_sm_session_sdp_changed((rtsp_sm_session *)subsession->parent_session);
+		return changed;
+}
+
 void rtsp_sm_clear_session(rtsp_sm_session *session)
 {
 		INIT_LIST_HEAD(&session->media_entry);
 		session->my_sdp_content_len = 0;
+		rtsp_sm_session_sdp_changed(session);
 		ATOMIC_SET(&session->subsession_cnt, 0);
 		ATOMIC_SET(&session->reference_cnt, 0);			
 }
@@ -528,6 +526,9 @@ int rtsp_sm_setup(rtsp_sm_session *session, void *parent, int max_subsession_nb,
 		session->my_sdp_max_len = max_sdp_size;
 		INIT_LIST_HEAD(&session->media_entry);
 		session->my_sdp_content_len = 0;
+		session->my_sdp_c_off = 0;
+		session->my_sdp_version = 0;
+		ATOMIC_SET(&session->sdp_version, 1);
 		ATOMIC_SET(&session->subsession_cnt, 0);
 		ATOMIC_SET(&session->reference_cnt, 0);
 		return 0;
@@ -535,18 +536,294 @@ int rtsp_sm_setup(rtsp_sm_session *session, void *parent, int max_subsession_nb,
 
 /* end of rtsp server media session */
 
+/* rtsp client connection */
+
+rtsp_client_conn *rtsp_client_conn_create(struct rtsp_server *server, int client_socket, u32 client_addr)
+{
+		int i;
+		int nb = server->server_media.max_subsession_nb;
+		rtsp_client_conn *conn = NULL;
+		for(i = 0; i < server->max_client_nb; i++)
+		{
+			if(server->conn_table[i] == NULL)
+				break;
+		}
+		if(i >= server->max_client_nb)
+		{
+			RTSP_WARN("\n\rmax client cnt reached!");
+			return NULL;
+		}
+		conn = malloc(sizeof(rtsp_client_conn));
+		if(conn == NULL)
+		{
+			RTSP_ERROR("\n\rallocate client connection failed");
+			return NULL;
+		}
+		memset(conn, 0, sizeof(rtsp_client_conn));
+		if((conn->bind = malloc(nb * sizeof(rtsp_cc_session))) == NULL)
+		{
+			RTSP_ERROR("\n\rallocate client binding failed");
+			free(conn);
+			return NULL;
+		}
+		memset(conn->bind, 0, nb * sizeof(rtsp_cc_session));
+		if((conn->rx_buf = malloc(REQUEST_BUF_SIZE)) == NULL)
+		{
+			RTSP_ERROR("\n\rallocate request buffer failed");
+			free(conn->bind);
+			free(conn);
+			return NULL;
+		}
+		rtsp_parser_init(&conn->parser, conn->rx_buf, REQUEST_BUF_SIZE);
+		INIT_LIST_HEAD(&conn->reap_anchor);
+		for(i = 0; i < nb; i++)
+		{
+			INIT_LIST_HEAD(&conn->bind[i].bind_anchor);
+			conn->bind[i].parent_conn = (void *)conn;
+			conn->bind[i].client_socket = -1;
+		}
+		conn->parent_server = (void *)server;
+		conn->client_socket = client_socket;
+		rtw_mutex_init(&conn->write_lock);
+		*(u32 *)conn->client_ip = client_addr;
+		conn->state_now = RTSP_INIT;
+		for(i = 0; i < server->max_client_nb; i++)
+		{
+			if(server->conn_table[i] == NULL)
+			{
+				server->conn_table[i] = conn;
+				break;
+			}
+		}
+		rtsp_client_conn_touch(conn);
+		rtsp_reaper_schedule(&server->reaper, conn);
+		return conn;
+}
+
+/* idle connection reaper */
+
+//idle time allowed before connection is reaped, advertised timeout applies once a session exists
+static u32 rtsp_client_conn_idle_limit(rtsp_client_conn *conn)
+{
+		u32 timeout = conn->session_info.session_timeout;
+		return ((timeout != 0) ? timeout : DEF_SESSION_TIMEOUT) + RTSP_REAP_GRACE;
+}
+
+//any request, interleaved frame or rtcp receiver report keeps connection alive
+void rtsp_client_conn_touch(rtsp_client_conn *conn)
+{
+		conn->last_active = rtw_get_current_time();
+}
+
+static void rtsp_reaper_init(struct rtsp_reap_wheel *wheel)
+{
+		int i;
+		for(i = 0; i < RTSP_REAP_WHEEL_SLOTS; i++)
+			INIT_LIST_HEAD(&wheel->slot[i]);
+		wheel->tick = 0;
+		wheel->last_time = rtw_get_current_time();
+}
+
+//queue idle check of connection for when it would expire if nothing arrives meanwhile
+static void rtsp_reaper_schedule(struct rtsp_reap_wheel *wheel, rtsp_client_conn *conn)
+{
+		u32 idle = rtw_systime_to_ms(rtw_get_current_time() - conn->last_active);
+		u32 limit = rtsp_client_conn_idle_limit(conn);
+		u32 ticks = (idle >= limit) ? 1 : (limit - idle + RTSP_REAP_TICK_MS - 1) / RTSP_REAP_TICK_MS;
+		conn->reap_tick = wheel->tick + ticks;
+		list_del_init(&conn->reap_anchor);
+		list_add_tail(&conn->reap_anchor, &wheel->slot[conn->reap_tick & (RTSP_REAP_WHEEL_SLOTS - 1)]);
+}
+
+//advance wheel to now, close connections idle past their limit and requeue the rest
+//activity only stamps last_active, connections are moved only when their slot comes up
+static void rtsp_server_reap(struct rtsp_server *server)
+{
+		struct rtsp_reap_wheel *wheel = &server->reaper;
+		rtsp_client_conn *conn, *next;
+		u32 now = rtw_get_current_time();
+		u32 steps = rtw_systime_to_ms(now - wheel->last_time) / RTSP_REAP_TICK_MS;
+		_list *slot;
+		if(steps == 0)
+			return;
+		wheel->last_time = now;
+		//a late housekeeping tick still visits every slot once at most
+		if(steps > RTSP_REAP_WHEEL_SLOTS)
+		{
+			wheel->tick += steps - RTSP_REAP_WHEEL_SLOTS;
+			steps = RTSP_REAP_WHEEL_SLOTS;
+		}
+		while(steps-- > 0)
+		{
+			slot = &wheel->slot[++wheel->tick & (RTSP_REAP_WHEEL_SLOTS - 1)];
+			list_for_each_entry_safe(conn, next, slot, reap_anchor, rtsp_client_conn)
+			{
+				//later round of the wheel
+				if((s32)(wheel->tick - conn->reap_tick) < 0)
+					continue;
+				if(rtw_systime_to_ms(now - conn->last_active) < rtsp_client_conn_idle_limit(conn))
+				{
+					wheel->resched_cnt++;
+					rtsp_reaper_schedule(wheel, conn);
+					continue;
+				}
+				RTSP_WARN("\n\rreap idle session %x", conn->session_info.session_id);
+				wheel->reap_cnt++;
+				//releases bindings, their ports and the sender once no viewer is left
+				rtsp_client_conn_free(conn);
+			}
+		}
+}
+
+/* end of idle connection reaper */
+
+//drop all subsession bindings of connection and return to init state
+void rtsp_client_conn_release(rtsp_client_conn *conn)
+{
+		struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+		rtsp_sm_subsession *subsession = NULL;
+		rtsp_client_conn_set_state(conn, RTSP_INIT);
+		list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
+		{
+			rtsp_sm_subsession_unbind(subsession, &conn->bind[subsession->id]);
+		}
+}
+
+//allowed connection state transitions, bit per target state
+static const u8 rtsp_state_next[] = {
+	[RTSP_INIT] = (1 << RTSP_INIT) | (1 << RTSP_READY),
+	[RTSP_READY] = (1 << RTSP_INIT) | (1 << RTSP_READY) | (1 << RTSP_PLAYING),
+	[RTSP_PLAYING] = (1 << RTSP_INIT) | (1 << RTSP_READY) | (1 << RTSP_PLAYING),
+};
+
+//the only place connection state changes, bound subsessions see the change under their client lock
+//and their senders are kicked at once instead of noticing it on their next poll
+int rtsp_client_conn_set_state(rtsp_client_conn *conn, rtsp_state state)
+{
+		struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+		rtsp_sm_subsession *subsession = NULL;
+		rtsp_cc_session *c;
+		u8 playing = (state == RTSP_PLAYING);
+		if(!(rtsp_state_next[conn->state_now] & (1 << state)))
+		{
+			RTSP_WARN("illegal state change %d -> %d", conn->state_now, state);
+			return -EPERM;
+		}
+		conn->state_now = state;
+		list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
+		{
+			c = &conn->bind[subsession->id];
+			if(!c->is_handled)
+				continue;
+			rtw_mutex_get(&subsession->client_lock);
+			if(c->is_playing != playing)
+			{
+				c->is_playing = playing;
+				subsession->play_cnt += playing ? 1 : -1;
+			}
+			rtw_mutex_put(&subsession->client_lock);
+			rtw_up_sema(&subsession->state_sema);
+			rtp_sink_wakeup(subsession->sink);
+		}
+		return 0;
+}
+
+void rtsp_client_conn_free(rtsp_client_conn *conn)
+{
+		int i;
+		struct rtsp_server *server;
+		if(conn == NULL)
+			return;
+		server = (struct rtsp_server *)conn->parent_server;
+		if(conn->play_pending)
+			server->play_pending_cnt--;
+		list_del_init(&conn->reap_anchor);
+		rtsp_client_conn_release(conn);
+		for(i = 0; i < server->max_client_nb; i++)
+		{
+			if(server->conn_table[i] == conn)
+				server->conn_table[i] = NULL;
+		}
+		if(conn->client_socket >= 0)
+		{
+			rtsp_reactor_del(&server->reactor, conn->client_socket);
+			close(conn->client_socket);
+		}
+		rtw_mutex_free(&conn->write_lock);
+		free(conn->rx_buf);
+		free(conn->bind);
+		free(conn);
+}
+
+//write all bytes to control socket, serialized against interleaved rtp senders
+int rtsp_client_conn_write(rtsp_client_conn *conn, u8 *buf, int len)
+{
+		int ret, sent = 0;
+		rtw_mutex_get(&conn->write_lock);
+		while(sent < len)
+		{
+			ret = write(conn->client_socket, buf + sent, len - sent);
+			if(ret <= 0)
+			{
+				rtw_mutex_put(&conn->write_lock);
+				return -EIO;
+			}
+			sent += ret;
+		}
+		rtw_mutex_put(&conn->write_lock);
+		return sent;
+}
+
+//send built response on control socket, serialized against interleaved rtp senders
+int rtsp_client_conn_send_response(rtsp_client_conn *conn, struct rtsp_response *res)
+{
+		int ret;
+		rtw_mutex_get(&conn->write_lock);
+		ret = rtsp_res_send(res, conn->client_socket);
+		rtw_mutex_put(&conn->write_lock);
+		return ret;
+}
+
+rtsp_client_conn *rtsp_server_find_session(struct rtsp_server *server, u32 session_id)
+{
+		int i;
+		rtsp_client_conn *conn;
+		if(session_id == 0)
+			return NULL;
+		for(i = 0; i < server->max_client_nb; i++)
+		{
+			conn = server->conn_table[i];
+			if(conn != NULL && conn->session_info.session_id == session_id)
+				return conn;
+		}
+		return NULL;
+}
+
+/* end of rtsp client connection */
+
 void rtsp_server_free(struct rtsp_server *server)
 {
+		int i;
+		for(i = 0; i < server->max_client_nb; i++)
+			rtsp_client_conn_free(server->conn_table[i]);
+		if(rtsp_server_stop_workers(server, RTP_WORKER_EXIT_TIMEOUT) < 0)
+		{
+			//a worker still runs on server media, leaking it is the only safe option
+			RTSP_ERROR("\n\r%d rtp workers still busy, server not freed", ATOMIC_READ(&server->worker_cnt));
+			return;
+		}
 		rtsp_sm_session_free(&server->server_media);
+		rtw_free_sema(&server->work_sema);
+		rtw_mutex_free(&server->work_lock);
 		free(server->adapter);
-		free(server->client_ip);
 		free(server->server_ip);
 		free(server);
-                if(ATOMIC_DEC_AND_TEST(&lock_ref_cnt))
+                if(ATOMIC_DEC_AND_TEST(&port_ref_cnt))
                 {
-                    rtw_mutex_free(&client_lower_port_lock);
-                    rtw_mutex_free(&server_lower_port_lock);
-                    rtw_mutex_free(&lower_port_lock);
+                    //anything still in use here leaked
+                    rtp_port_range_dump(&client_port_range, "client");
+                    rtp_port_range_dump(&server_port_range, "server");
+                    rtp_port_range_dump(&mcast_port_range, "multicast");
                 }
 }
 
@@ -566,32 +843,30 @@ struct rtsp_server *rtsp_server_create(rtsp_server_adapter *adapter)
 				free(server);
 				return NULL;		
 		}
-		if((server->client_ip = malloc(RTSP_IP_SIZE)) == NULL)
-		{
-				RTSP_ERROR("\n\rallocate client ip failed");
-				free(server->server_ip);
-				free(server);
-		}
 		//default server media setup
 		if(rtsp_sm_setup(&server->server_media, (void *)server, \
 		(adapter->max_subsession_nb <= 0) ? 1 : adapter->max_subsession_nb, MAX_SDP_SIZE) < 0)
 		{
 			RTSP_ERROR("\n\rmedia setup failed");
-			free(server->client_ip);
 			free(server->server_ip);
 			free(server);
 			return NULL;
 		}
 		server->server_socket = -1;
-                server->client_socket = -1;
+		server->max_client_nb = (adapter->max_client_nb <= 0) ? RTSP_MAX_CLIENT_DEF : adapter->max_client_nb;
+		if(server->max_client_nb > RTSP_MAX_CLIENT_NB)
+			server->max_client_nb = RTSP_MAX_CLIENT_NB;
 		server->adapter = adapter;
-                if(client_lower_port_lock == NULL)
-                    rtw_mutex_init(&client_lower_port_lock);
-                if(server_lower_port_lock == NULL)
-                    rtw_mutex_init(&server_lower_port_lock);
-                if(lower_port_lock == NULL)
-                    rtw_mutex_init(&lower_port_lock);
-                ATOMIC_INC(&lock_ref_cnt);
+		INIT_LIST_HEAD(&server->work_list);
+		rtw_mutex_init(&server->work_lock);
+		rtw_init_sema(&server->work_sema, 0);
+		ATOMIC_SET(&server->worker_cnt, 0);
+                if(ATOMIC_INC_RETURN(&port_ref_cnt) == 1)
+                {
+                    rtp_port_range_init(&client_port_range, RTP_CLIENT_PORT_BASE, RTP_CLIENT_PORT_RANGE);
+                    rtp_port_range_init(&server_port_range, RTP_SERVER_PORT_BASE, RTP_SERVER_PORT_RANGE);
+                    rtp_port_range_init(&mcast_port_range, RTP_PORT_BASE, RTP_PORT_RANGE);
+                }
 		return server;
 }
 
@@ -634,26 +909,239 @@ int rtsp_server_setup(struct rtsp_server *server, const u8* server_url, int port
 		return 0;
 }
 
-void rtp_unicast_service(void *ctx)
+//return number of bindings in PLAYING state, kept up to date by the connection state machine
+static int rtsp_sm_subsession_play_cnt(rtsp_sm_subsession *subsession)
+{
+        return subsession->play_cnt;
+}
+
+//finish a write the send window cut short, retried without blocking for up to timeout_ms
+static int rtsp_sock_send_bounded(int sock, u8 *buf, int len, u32 timeout_ms)
+{
+        u32 start = rtw_get_current_time();
+        int ret, sent = 0;
+        while(sent < len)
+        {
+                ret = send(sock, buf + sent, len - sent, MSG_DONTWAIT);
+                if(ret > 0)
+                {
+                        sent += ret;
+                        continue;
+                }
+                if(rtw_systime_to_ms(rtw_get_current_time() - start) >= timeout_ms)
+                        return -ETIMEDOUT;
+                rtw_msleep_os(1);
+        }
+        return sent;
+}
+
+//push coalesced interleaved frames of a client to its rtsp connection without waiting for the viewer,
+//the buffer is lost while its window is closed and a viewer closed for RTP_TCP_STALL_TIMEOUT is dropped
+static int rtsp_cc_session_flush_tcp(rtsp_cc_session *c)
 {
+        rtsp_client_conn *conn = (rtsp_client_conn *)c->parent_conn;
+        int len = c->tcp_buf_len;
+        int sent;
+        if(len == 0)
+                return 0;
+        c->tcp_buf_len = 0;
+        if(conn->tx_broken)
+                return -EAGAIN;
+        rtw_mutex_get(&conn->write_lock);
+        sent = send(conn->client_socket, c->tcp_buf, len, MSG_DONTWAIT);
+        //a frame is cut, it has to be completed before anything else goes on the stream
+        if(sent > 0 && sent < len && rtsp_sock_send_bounded(conn->client_socket, c->tcp_buf + sent, len - sent, RTP_TCP_FRAME_TIMEOUT) < 0)
+                conn->tx_broken = 1;
+        rtw_mutex_put(&conn->write_lock);
+        if(sent > 0 && !conn->tx_broken)
+        {
+                c->tcp_stall_time = 0;
+                return 0;
+        }
+        c->tcp_drop_cnt++;
+        if(c->tcp_stall_time == 0)
+                c->tcp_stall_time = rtw_get_current_time();
+        else if(rtw_systime_to_ms(rtw_get_current_time() - c->tcp_stall_time) >= RTP_TCP_STALL_TIMEOUT)
+                conn->tx_broken = 1;
+        if(conn->tx_broken)
+                RTSP_WARN("\n\rinterleaved viewer %x stalled, dropped %d buffers", conn->session_info.session_id, c->tcp_drop_cnt);
+        return -EAGAIN;
+}
+
+//frame one rtp packet as '$'<channel><len> into coalescing buffer, write out only when full
+static int rtsp_cc_session_send_tcp(rtsp_cc_session *c, u8 *hdr, int hdr_len, u8 *payload, int payload_len)
+{
+        int len = hdr_len + payload_len;
+        int ret = 0;
+        u8 *ptr;
+        if(((rtsp_client_conn *)c->parent_conn)->tx_broken)
+                return -EAGAIN;
+        //buffer is empty afterwards whether or not it went out
+        if(c->tcp_buf_len + RTP_TCP_FRAME_HDR_SZ + len > RTP_TCP_COALESCE_SIZE)
+                ret = rtsp_cc_session_flush_tcp(c);
+        ptr = c->tcp_buf + c->tcp_buf_len;
+        *ptr++ = '$';
+        *ptr++ = c->transport.interleaved_even;
+        *ptr++ = (u8)(len >> 8);
+        *ptr++ = (u8)len;
+        memcpy(ptr, hdr, hdr_len);
+        memcpy(ptr + hdr_len, payload, payload_len);
+        c->tcp_buf_len += RTP_TCP_FRAME_HDR_SZ + len;
+        return ret;
+}
+
+//send one packet of fragment list to a client, rtp header is patched on a private copy
+//and payload goes out by reference from the frame, seq_no is that of the first packet of list
+static int rtsp_cc_session_send_frag(rtsp_cc_session *c, u16 seq_no, rtp_sink_t *sink, struct rtp_frag_list *list, int idx)
+{
+        struct rtp_frag *frag = &list->frag[idx];
+        int len = frag->hdr_len + frag->payload_len;
         int ret;
-	p_rtsp_sm_subsession subsession = (p_rtsp_sm_subsession)ctx;
+        u8 *buf = rtp_buf_get(&sink->tx_pool);
+        if(buf == NULL)
+                return -ENOMEM;
+        memcpy(buf, rtp_frag_hdr(list, idx), frag->hdr_len);
+        rtp_patch_header(buf, (u16)(seq_no + idx), list->ts + frag->ts_delta + c->ts_offset, c->transport.ssrc);
+        if(c->transport.lower_proto == TRANS_LOWER_PROTO_TCP)
+        {
+                ret = rtsp_cc_session_send_tcp(c, buf, frag->hdr_len, frag->payload, frag->payload_len);
+                if(ret == 0)
+                        sink->octet_cnt += len;
+        }else
+                ret = rtp_sink_sendv_queue(sink, *(uint32_t *)c->client_ip, c->transport.client_port_even, buf, frag->hdr_len, frag->payload, frag->payload_len);
+        rtp_buf_put(&sink->tx_pool, buf);
+        return ret;
+}
+
+//multicast group as taken at frame start, the last member leaving clears the subsession fields meanwhile
+struct rtsp_group_dest
+{
+        u32 addr;
+        u16 port;
+        u16 seq_no;
+        u32 ssrc;
+        u32 ts_offset;
+        u8 ttl;
+};
+
+//send the packet once to the multicast group of subsession, every group member receives the same copy
+static int rtsp_sm_subsession_send_group(rtp_sink_t *sink, struct rtsp_group_dest *g, struct rtp_frag_list *list, int idx)
+{
+        struct rtp_frag *frag = &list->frag[idx];
+        int ret;
+        u8 *buf = rtp_buf_get(&sink->tx_pool);
+        if(buf == NULL)
+                return -ENOMEM;
+        memcpy(buf, rtp_frag_hdr(list, idx), frag->hdr_len);
+        rtp_patch_header(buf, (u16)(g->seq_no + idx), list->ts + frag->ts_delta + g->ts_offset, g->ssrc);
+        ret = rtp_sink_sendv_queue(sink, g->addr, g->port, buf, frag->hdr_len, frag->payload, frag->payload_len);
+        rtp_buf_put(&sink->tx_pool, buf);
+        return ret;
+}
+
+/*
+ * Send packets of current frame to every playing client of subsession.
+ * Destinations and their sequence numbers are taken under client lock,
+ * sockets are written with only tx lock held, so control requests on
+ * other connections never wait for a slow viewer. Bindings stay valid
+ * until tx lock is released since unbind takes it first.
+ */
+int rtsp_sm_subsession_fanout(rtsp_sm_subsession *subsession, struct rtp_frag_list *list)
+{
+        rtp_sink_t *sink = subsession->sink;
+        rtsp_cc_session *c = NULL;
+        rtsp_cc_session *dest[RTSP_MAX_CLIENT_NB];
+        u16 dest_seq[RTSP_MAX_CLIENT_NB];
+        struct rtsp_group_dest group;
+        int i, j, dest_nb = 0, ret = 0;
+        int group_playing = 0, udp_dest = 0;
+        u32 frame_bytes = 0;
+        rtw_mutex_get(&subsession->tx_lock);
+        rtw_mutex_get(&subsession->client_lock);
+        //group is fed as long as one of its members is playing
+        list_for_each_entry(c, &subsession->client_list, bind_anchor, rtsp_cc_session)
+        {
+                if(!rtsp_cc_session_is_playing(c))
+                        continue;
+                if(c->transport.cast_mode == MULTICAST_MODE)
+                {
+                        group_playing = 1;
+                        continue;
+                }
+                //one binding per connection and subsession
+                if(dest_nb == RTSP_MAX_CLIENT_NB)
+                        break;
+                if(c->transport.lower_proto != TRANS_LOWER_PROTO_TCP)
+                        udp_dest++;
+                dest_seq[dest_nb] = c->seq_no;
+                c->seq_no += list->frag_cnt;
+                dest[dest_nb++] = c;
+        }
+        if(group_playing)
+        {
+                group.addr = subsession->mcast_addr;
+                group.port = subsession->mcast_port_even;
+                group.seq_no = subsession->mcast_seq_no;
+                group.ssrc = subsession->mcast_ssrc;
+                group.ts_offset = subsession->mcast_ts_offset;
+                group.ttl = subsession->mcast_ttl;
+                subsession->mcast_seq_no += list->frag_cnt;
+        }
+        rtw_mutex_put(&subsession->client_lock);
+        //spread udp packets of this frame over the frame interval
+        for(i = 0; i < list->frag_cnt; i++)
+                frame_bytes += list->frag[i].hdr_len + list->frag[i].payload_len;
+        rtp_sink_pace_frame(sink, frame_bytes * (udp_dest + group_playing), list->ts);
+        if(group_playing && sink->mcast_ttl != group.ttl)
+        {
+                if(setsockopt(sink->rtp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &group.ttl, sizeof(group.ttl)) < 0)
+                        RTSP_WARN("\n\rset multicast ttl %d failed", group.ttl);
+                sink->mcast_ttl = group.ttl;
+        }
+        //packet-major order so that all viewers see the same frame latency
+        for(i = 0; i < list->frag_cnt; i++)
+        {
+                if(group_playing && rtsp_sm_subsession_send_group(sink, &group, list, i) < 0)
+                        ret = -EAGAIN;
+                for(j = 0; j < dest_nb; j++)
+                {
+                        if(rtsp_cc_session_send_frag(dest[j], dest_seq[j], sink, list, i) < 0)
+                                ret = -EAGAIN;
+                }
+        }
+        //udp packets of the frame leave in as few socket calls as possible
+        if(rtp_sink_flush(sink) < 0)
+                ret = -EAGAIN;
+        sink->tx_frame_cnt++;
+        //interleaved clients get the frame tail at frame end
+        for(j = 0; j < dest_nb; j++)
+        {
+                if(dest[j]->transport.lower_proto == TRANS_LOWER_PROTO_TCP && rtsp_cc_session_flush_tcp(dest[j]) < 0)
+                        ret = -EAGAIN;
+        }
+        rtw_mutex_put(&subsession->tx_lock);
+        sink->seq_no += list->frag_cnt;
+        return ret;
+}
+
+//frame fills the fragment list, its packets so far go out before the rest is packetized
+static int rtsp_sm_subsession_frag_flush(void *ctx, struct rtp_frag_list *list)
+{
+        return rtsp_sm_subsession_fanout((rtsp_sm_subsession *)ctx, list);
+}
+
+//common sender loop, unicast and multicast bindings of the subsession are all served by fanout
+static void rtp_service(p_rtsp_sm_subsession subsession)
+{
+        int ret, idle;
         rtp_sink_t *sink = subsession->sink;
 	p_rtsp_sm_session session = subsession->parent_session;
 	struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
 	int rtp_socket, rtp_port;
 	struct sockaddr_in rtp_addr;
 	socklen_t rtp_addrlen = sizeof(struct sockaddr_in);
-#if 0
-	int rtcp_socket, rtcp_port;
-	struct sockaddr_in rtcp_addr;
-	socklen_t rtcp_addrlen = sizeof(struct sockaddr_in);
-#endif	
-        //wait until server state change to RTSP_PLAYING
-        //rtw_msleep_os(1000);
-        
 	rtp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-	rtp_port = subsession->client.transport.server_port_even;
+	rtp_port = subsession->server_port_even;
 	memset(&rtp_addr, 0, rtp_addrlen);
 	rtp_addr.sin_family = AF_INET;
 	rtp_addr.sin_addr.s_addr = *(uint32_t *)(server->server_ip);
@@ -663,49 +1151,67 @@ void rtp_unicast_service(void *ctx)
 		RTSP_ERROR("bind failed");
 		goto exit;
 	}
-#if 0	
-	rtcp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-	rtcp_port = subsession->client.transport.server_port_odd;
-	memset(&rtp_addr, 0, rtcp_addrlen);
-	rtcp_addr.sin_family = AF_INET;
-	rtcp_addr.sin_addr.s_addr = *(uint32_t *)(server->server_ip);
-        rtcp_addr.sin_port = _htons(rtcp_port);
-	if(bind(rtcp_socket, (struct sockaddr *)&rtcp_addr, rtcp_addrlen)<0)
-	{
-		RTSP_ERROR("bind failed");
-		goto exit;
-	}
-#endif
 	//default implementation via UDP
-	//init sink status here
+	//init sink status here, ssrc and seq_no are kept per client binding
         sink->rtp_sock = rtp_socket;
-#if 0
-        sink->rtcp_sock = rtcp_socket;
-#endif
-        sink->ssrc = subsession->client.transport.ssrc;
+        //rtcp socket is owned and polled by server reactor
+        sink->rtcp_sock = subsession->rtcp_sock;
+        sink->mcast_ttl = 0;
         sink->base_ts = 0;
         sink->seq_no = 0;
         sink->packet_cnt = 0;
         sink->octet_cnt = 0;
         sink->total_octet_cnt = 0;
+        //frames queued while nobody was playing are stale
+        rtp_sink_ring_flush(sink);
         
+        //codec has no packetizer
+        if(sink->media_hdl_ops == NULL)
+        {
+            RTSP_ERROR("\n\rno packetizer for %s", sink->codec_name);
+            goto exit;
+        }
+        if(rtp_frag_list_init(&sink->frags, RTP_FRAG_MAX_NB, RTP_FRAG_ARENA_SIZE) < 0)
+            goto exit;
+        rtp_frag_list_set_flush(&sink->frags, rtsp_sm_subsession_frag_flush, (void *)subsession);
+        if(rtp_sink_tx_init(sink) < 0)
+        {
+            rtp_frag_list_free(&sink->frags);
+            goto exit;
+        }
         //init codec specific extra ctx if any
         if(subsession->sink->media_hdl_ops->packet_extra_init)
         {
             ret = subsession->sink->media_hdl_ops->packet_extra_init((void *)subsession);
             if(ret < 0)
+            {
+                rtp_sink_tx_deinit(sink);
+                rtp_frag_list_free(&sink->frags);
                 goto exit;
+            }
         }
 	//do we need a signal to indicate service start?
         ATOMIC_INC(&server->server_media.reference_cnt);
-restart:	
-	while(server->state_now == RTSP_PLAYING && server->is_launched)
+restart:
+	rtw_mutex_get(&subsession->client_lock);
+	//PLAY may have been answered 503 while we were queued, do not arm for nobody
+	if(subsession->play_cnt > 0)
+		subsession->sender_state = RTP_SENDER_STREAMING;
+	rtw_mutex_put(&subsession->client_lock);
+	//deferred PLAY replies are sent by server task, kick it only while one waits
+	if(subsession->sender_state == RTP_SENDER_STREAMING && server->play_pending_cnt > 0)
+		rtsp_reactor_wakeup(&server->reactor);
+	//keep running as long as any client is playing this subsession
+	while(server->is_launched && rtsp_sm_subsession_play_cnt(subsession) > 0)
 	{
 		if(subsession->sink->media_hdl_ops->packet_send)
                 {
-                    if(rtp_sink_wait_frame_ready(sink) < 0)
+                    //sleep until encoder queues a frame or session state changes
+                    if(rtp_sink_wait_frame_ready(sink, RTP_FRAME_WAIT_TIMEOUT) < 0)
+                          continue;
+                    //frame may have been dropped by encoder in between
+                    if(rtp_sink_ind_frame_process(sink) < 0)
                           continue;
-                    rtp_sink_ind_frame_process(sink);
                     ret = subsession->sink->media_hdl_ops->packet_send((void *)subsession);
                     if(ret < 0)
                     {
@@ -713,53 +1219,116 @@ restart:
                     }
                     rtp_sink_ind_frame_sent(subsession->sink);
                 }
-                    //update status here 
-                if(sink->seq_no == 0)
-                    sink->base_ts = sink->now_ts;
-                //rtw_msleep_os(1);
 	}
+	rtw_mutex_get(&subsession->client_lock);
+	subsession->sender_state = RTP_SENDER_PAUSED;
+	rtw_mutex_put(&subsession->client_lock);
 pause:
-	rtw_msleep_os(1000);
-	if(server->state_now == RTSP_READY)
+	//sleep until a bound connection changes state, a sender with no viewer left detaches at once
+	rtw_mutex_get(&subsession->client_lock);
+	idle = (!server->is_launched || subsession->client_cnt == 0) && subsession->play_cnt == 0;
+	rtw_mutex_put(&subsession->client_lock);
+	if(!idle)
+		rtw_down_timeout_sema(&subsession->state_sema, RTP_SENDER_RECHECK);
+	//decide under client lock so that a concurrent PLAY either sees us running or restarts us
+	rtw_mutex_get(&subsession->client_lock);
+	if(server->is_launched && subsession->play_cnt > 0)
 	{
+		rtw_mutex_put(&subsession->client_lock);
+		//frames queued while paused are stale, resume with the next one
+		rtp_sink_ring_flush(sink);
+		subsession->resume_cnt++;
 		goto restart;
 	}
+	if(server->is_launched && subsession->client_cnt > 0)
+	{
+		rtw_mutex_put(&subsession->client_lock);
+		goto pause;
+	}
         ATOMIC_DEC(&server->server_media.reference_cnt);
         //deinit codec specific extra ctx if any
         if(subsession->sink->media_hdl_ops->packet_extra_deinit)
                 subsession->sink->media_hdl_ops->packet_extra_deinit((void *)subsession);        
+        rtp_sink_tx_dump(sink);
+        rtp_sink_ring_dump(sink);
+        rtp_sink_tx_deinit(sink);
+        rtp_frag_list_free(&sink->frags);
+	close(rtp_socket);
+	goto out;
 exit:
-        server->state_now = RTSP_INIT;  
 	close(rtp_socket);
-#if 0
-        close(rtcp_socket);
-#endif        
+        rtw_mutex_get(&subsession->client_lock);
+out:
+        subsession->is_running = 0;
+        subsession->sender_state = RTP_SENDER_IDLE;
+        if(subsession->client_cnt == 0)
+                rtsp_sm_subsession_put_server_port(subsession);
+        rtw_mutex_put(&subsession->client_lock);
         RTSP_INFO("rtp session closed");
-	vTaskDelete(NULL);	
 }
 
+void rtp_unicast_service(void *ctx)
+{
+        rtp_service((p_rtsp_sm_subsession)ctx);
+}
+
+//multicast viewers of a subsession share one group, each packet is sent once regardless of viewer count
 void rtp_multicast_service(void *ctx)
 {
-	
+        p_rtsp_sm_subsession subsession = (p_rtsp_sm_subsession)ctx;
+        RTSP_INFO("\n\rmulticast group %d.%d.%d.%d:%d members:%d", ((u8 *)&subsession->mcast_addr)[0], ((u8 *)&subsession->mcast_addr)[1], \
+                  ((u8 *)&subsession->mcast_addr)[2], ((u8 *)&subsession->mcast_addr)[3], subsession->mcast_port_even, subsession->mcast_cnt);
+        rtp_service(subsession);
 }
 
-int rtsp_on_req_OPTIONS(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
-{       
-	u8 response[256] = {0};
-	if(server->CSeq_now > server->message.CSeq && server->state_now != RTSP_INIT)
+//method list for Public header, built from the dispatch table on first OPTIONS
+static u8 rtsp_public[128];
+static int rtsp_public_len = 0;
+
+//status line and CSeq common to every reply
+static void rtsp_res_start(struct rtsp_response *res, const char *status, int status_len, u32 cseq)
+{
+	rtsp_res_init(res);
+	rtsp_res_add(res, status, status_len);
+	rtsp_res_add_lit(res, CRLF);
+	rtsp_res_add_hdr(res, RTSP_HDR_CSEQ);
+	rtsp_res_add_u32(res, cseq);
+	rtsp_res_add_lit(res, CRLF);
+}
+#define rtsp_res_status(res, status, cseq)	rtsp_res_start((res), (status), sizeof(status) - 1, (cseq))
+
+static void rtsp_res_add_session(struct rtsp_response *res, rtsp_client_conn *conn, int with_timeout)
+{
+	rtsp_res_add_hdr(res, RTSP_HDR_SESSION);
+	rtsp_res_add_hex(res, conn->session_info.session_id);
+	if(with_timeout)
+	{
+		//rfc 2326 12.37, timeout in seconds after ';', the reaper enforces it
+		rtsp_res_add_lit(res, ";timeout=");
+		rtsp_res_add_u32(res, conn->session_info.session_timeout / 1000);
+	}
+	rtsp_res_add_lit(res, CRLF);
+}
+
+int rtsp_on_req_OPTIONS(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
+{
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
+	if(conn->CSeq_now > conn->message.CSeq && conn->state_now != RTSP_INIT)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;
+	conn->CSeq_now = conn->message.CSeq;
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);
-	sprintf(response, RTSP_RES_OK CRLF \
-						"CSeq: %d" CRLF \
-						PUBLIC_CMD_STR CRLF \
-						CRLF, server->CSeq_now);
-        //rtsp_res_dump(response, strlen(response));
-	return write(server->client_socket, response, strlen(response));
+	if(rtsp_public_len == 0)
+		rtsp_public_len = rtsp_method_list(rtsp_public, sizeof(rtsp_public));
+	rtsp_res_status(&res, RTSP_RES_OK, conn->CSeq_now);
+	rtsp_res_add_hdr(&res, RTSP_HDR_PUBLIC);
+	rtsp_res_add(&res, rtsp_public, rtsp_public_len);
+	rtsp_res_add_lit(&res, CRLF CRLF);
+	return rtsp_client_conn_send_response(conn, &res);
 }
 
 static void rtsp_session_info_set(struct rtsp_session_info *s, u32 session_id, u32 session_timeout, u8 *user, u8 *name, u8 *info, u32 version, u64 start_time, u64 end_time)
@@ -793,101 +1362,50 @@ static void rtsp_session_info_set(struct rtsp_session_info *s, u32 session_id, u
 	s->end_time = end_time;
 }
 
-#if 0
-static u8 *data_to_hex(u8 *buff, u8 *src, int s, int lowercase)
-{
-    int i;
-    static const char hex_table_uc[16] = { '0', '1', '2', '3',
-                                        '4', '5', '6', '7',
-                                        '8', '9', 'A', 'B',
-                                        'C', 'D', 'E', 'F' };
-    static const char hex_table_lc[16] = { '0', '1', '2', '3',
-                                        '4', '5', '6', '7',
-                                        '8', '9', 'a', 'b',
-                                        'c', 'd', 'e', 'f' };
-    const char *hex_table = lowercase ? hex_table_lc : hex_table_uc;
-    for(i = 0; i < s; i++) {
-        buff[i * 2]     = hex_table[src[i] >> 4];
-        buff[i * 2 + 1] = hex_table[src[i] & 0xF];
-    }
-
-    return buff;
-}
-
-static u8 *extradata2config(void *extra)
-{
-   u8 *config;
-
-   if(strlen(extra) > 1024)
-   {
-        RTSP_INFO("\n\rtoo much extra data!");
-        return NULL;
-   }
-   config = malloc(10 + strlen(extra)*2);
-   if (config == NULL) {
-       RTSP_INFO("\n\rallocate config memory failed");
-       return NULL;
-   }
-   memcpy(config, "; config=", 9);
-   data_to_hex(config + 9, extra, strlen(extra), 1);
-   config[9 + strlen(extra) * 2] = 0;
-
-   return config;
-}
-
-static int get_frequency_index(int samplerate)
-{
-	uint32_t freq_idx_map[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
-	for(int i=0;i<sizeof(freq_idx_map)/sizeof(freq_idx_map[0]);i++){
-		if(samplerate==freq_idx_map[i])
-			return i;
-	}
-	return 0xf;		// 15: frequency is written explictly 
-}
-#endif
-
-static void sdp_fill_subsession_a_field(u8 *buf, int max_len, rtsp_sm_subsession *subsession)
+static void sdp_fill_subsession_a_field(struct sdp_writer *w, rtsp_sm_subsession *subsession)
 {
 	rtp_sink_t *sink = subsession->sink;
-        unsigned char string[128];
-	unsigned char spspps_str[128];
 	//do we need to check if has sink?
 	switch(sink->codec_id){
 		case(AV_CODEC_ID_MJPEG):
-			sprintf(string, "a=rtpmap:%d JPEG/%d" CRLF \
+			sdp_printf(w, "a=rtpmap:%d JPEG/%d" CRLF \
 							"a=control:streamid=%d" CRLF \
 							"a=framerate:%d" CRLF \
 							, sink->pt, sink->frequency, subsession->id, sink->frame_rate);
 			break;
 		case(AV_CODEC_ID_H264):
-
-			sprintf(string, "a=rtpmap:%d H264/%d" CRLF \
+			//sprop-parameter-sets and profile-level-id once the packetizer has seen SPS and PPS
+			rtw_mutex_get(&subsession->client_lock);
+			sdp_printf(w, "a=rtpmap:%d H264/%d" CRLF \
 							"a=control:streamid=%d" CRLF \
-							"a=fmtp:%d packetization-mode=0%s" CRLF \
-							, sink->pt + subsession->id, sink->frequency, subsession->id, sink->pt + subsession->id, spspps_str);
+							"a=fmtp:%d packetization-mode=1%s" CRLF \
+							, sink->pt + subsession->id, sink->frequency, subsession->id, sink->pt + subsession->id, subsession->fmtp);
+			rtw_mutex_put(&subsession->client_lock);
 			break;
 		case(AV_CODEC_ID_PCMU):
-			sprintf(string, "a=rtpmap:%d PCMU/%d" CRLF             \
-							"a=ptime:20" CRLF						\
+			sdp_printf(w, "a=rtpmap:%d PCMU/%d" CRLF             \
+							"a=ptime:%d" CRLF						\
 							"a=control:streamid=%d" CRLF            \
-							, sink->pt, sink->frequency, subsession->id); 
+							, sink->pt, sink->frequency, sink->ptime, subsession->id); 
 			break;		
 		case(AV_CODEC_ID_PCMA):
-			sprintf(string, "a=rtpmap:%d PCMA/%d" CRLF             \
-							"a=ptime:20" CRLF						\
+			sdp_printf(w, "a=rtpmap:%d PCMA/%d" CRLF             \
+							"a=ptime:%d" CRLF						\
 							"a=control:streamid=%d" CRLF            \
-							, sink->pt, sink->frequency, subsession->id); 
+							, sink->pt, sink->frequency, sink->ptime, subsession->id); 
 			break;	
-#if 0
 		case(AV_CODEC_ID_MP4A_LATM):
-			sprintf(string, "a=rtpmap:%d mpeg4-generic/%d/%d" CRLF     \
-							"a=fmtp:%d streamtype=5; profile-level-id=15; mode=AAC-hbr%s; sizeLength=13; indexLength=3; indexDeltaLength=3; constantDuration=1024; Profile=1"  CRLF         \
+			//AAC-hbr with 13 bit size and 3 bit index AU-headers, config from AudioSpecificConfig
+			rtw_mutex_get(&subsession->client_lock);
+			sdp_printf(w, "a=rtpmap:%d mpeg4-generic/%d/%d" CRLF     \
+							"a=fmtp:%d streamtype=5; profile-level-id=15; mode=AAC-hbr; sizelength=13; indexlength=3; indexdeltalength=3%s"  CRLF         \
 							"a=control:streamid=%d" CRLF \
-							/*	  "a=type:broadcast"  CRLF \*/
-							, sink->pt + subsession->id, sink->frequency, sink->nb_channels, sink->pt + subsession->id, config? config:"", subsession->id);  
+							, sink->pt + subsession->id, sink->frequency, sink->nb_channels, sink->pt + subsession->id, subsession->fmtp, subsession->id);  
+			rtw_mutex_put(&subsession->client_lock);
 			break;
+#if 0
 		case(AV_CODEC_ID_MP4V_ES):
-			sprintf(string, "a=rtpmap:%d MPEG4-ES/%d" CRLF     \
+			sdp_printf(w, "a=rtpmap:%d MPEG4-ES/%d" CRLF     \
 							"a=control:streamid=%d" CRLF \
 							"a=fmtp:%d profile-level-id=1%s"  CRLF         \
 							, sink->pt + subsession->id, sink->frequency, subsession->id, sink->pt + subsession->id, config? config:"");  
@@ -896,94 +1414,127 @@ static void sdp_fill_subsession_a_field(u8 *buf, int max_len, rtsp_sm_subsession
 		default:
 			break;			
 	}
-        sdp_strcat(buf, max_len, string);
 }
 
-void rtsp_create_sdp(struct rtsp_server *server)
+//rebuild client independent sdp of session, caller splices session level c= per client
+static void rtsp_sm_session_build_sdp(rtsp_sm_session *session)
 {
-	int i;
-	u8 *unicast_addr, *connection_addr;
-	u8 *sdp_buf = server->server_media.my_sdp;
-	int max_len = server->server_media.my_sdp_max_len;
-	struct rtsp_session_info *s = &server->server_media.session_info;
+	struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
+	struct sdp_writer w;
+	struct rtsp_session_info *s = &session->session_info;
 	rtsp_sm_subsession *subsession = NULL;
 	u8 nettype[] = "IN";
 	u8 addrtype[] = "IP4";
-	unicast_addr = server->server_ip;
-	connection_addr = server->client_ip;
+	u32 version = ATOMIC_READ(&session->sdp_version);
+	sdp_writer_init(&w, session->my_sdp, session->my_sdp_max_len);
 	//sdp session level
 	/* fill Protocol Version -- only have Version 0 for now*/	
-	sprintf(sdp_buf, "v=0" CRLF);
-	sdp_fill_o_field(sdp_buf, max_len, s->user, s->session_id, s->version, nettype, addrtype, unicast_addr);
-	sdp_fill_s_field(sdp_buf, max_len, s->name);
-	sdp_fill_c_field(sdp_buf, max_len, nettype, addrtype, connection_addr, server->message.transport.ttl);
-	sdp_fill_t_field(sdp_buf, max_len, s->start_time, s->end_time);	
+	sdp_printf(&w, "v=0" CRLF);
+	sdp_fill_o_field(&w, s->user, s->session_id, s->version, nettype, addrtype, server->server_ip);
+	sdp_fill_s_field(&w, s->name);
+	session->my_sdp_c_off = w.len;
+	sdp_fill_t_field(&w, s->start_time, s->end_time);	
 	//sdp media level
-	list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
+	list_for_each_entry(subsession, &session->media_entry, media_anchor, rtsp_sm_subsession)
 	{
+		u32 group_addr = 0;
+		u16 group_port = 0;
+		u8 group_ttl = 0;
+		//fixed group is advertised up front, one picked by a viewer once it exists
+		if(!rtsp_sm_subsession_fixed_group(subsession, &group_addr, &group_port, &group_ttl) && subsession->mcast_cnt > 0)
+		{
+			group_addr = subsession->mcast_addr;
+			group_port = subsession->mcast_port_even;
+			group_ttl = subsession->mcast_ttl;
+		}
 		//fill subsession sdp descriptions
 		if(subsession->sink->pt == RTP_PT_DYN_BASE)
-			sdp_fill_m_field(sdp_buf, max_len, subsession->sink->media_type, 0, subsession->id + subsession->sink->pt);
+			sdp_fill_m_field(&w, subsession->sink->media_type, group_port, subsession->id + subsession->sink->pt);
 		else
-			sdp_fill_m_field(sdp_buf, max_len, subsession->sink->media_type, 0, subsession->sink->pt);
-		sdp_fill_subsession_a_field(sdp_buf, max_len, subsession);
+			sdp_fill_m_field(&w, subsession->sink->media_type, group_port, subsession->sink->pt);
+		//media level connection overrides session level one for multicast group
+		if(group_addr != 0)
+			sdp_fill_c_field(&w, nettype, addrtype, (u8 *)&group_addr, group_ttl);
+		//the same bit_rate sets pacing rate of the sink
+		if(subsession->sink->bit_rate > 0)
+			sdp_fill_b_field(&w, SDP_BWTYPE_AS, subsession->sink->bit_rate / 1000);
+		sdp_fill_subsession_a_field(&w, subsession);
 	}
-        server->server_media.my_sdp_content_len = strlen(sdp_buf);
+	if(w.err < 0)
+		RTSP_WARN("\n\rsdp truncated at %d bytes", w.len);
+	session->my_sdp_content_len = w.len;
+	session->my_sdp_version = version;
 }
 
-int rtsp_on_req_DESCRIBE(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
+int rtsp_on_req_DESCRIBE(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
 {
-	u8 response[1024] = {0};
-	if(server->CSeq_now > server->message.CSeq)
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	rtsp_sm_session *media = &server->server_media;
+	struct rtsp_response res;
+	struct sdp_writer w;
+	u8 c_line[48];
+	if(conn->CSeq_now > conn->message.CSeq)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;       
-	if(server->state_now != RTSP_INIT)
+	conn->CSeq_now = conn->message.CSeq;       
+	if(conn->state_now != RTSP_INIT)
 	{
 		RTSP_WARN("illogical request!");
 		return -EINVAL;
 	}
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);
-	rtsp_session_info_set(&server->server_media.session_info, 0, 0, NULL, NULL, NULL, 0, 0, 0); //use default session settings;
+	//use default session settings, session id of media is shared by sdp of all clients
+	if(server->server_media.session_info.session_id == 0)
+		rtsp_session_info_set(&server->server_media.session_info, 0, 0, NULL, NULL, NULL, 0, 0, 0);
+	if(conn->session_info.session_id == 0)
+		rtsp_session_info_set(&conn->session_info, 0, 0, NULL, NULL, NULL, 0, 0, 0);
 	//read sdp if any or create general sdp 
 	if(server->server_media.my_sdp == NULL || server->server_media.my_sdp_max_len == 0)
 	{
 		RTSP_ERROR("no sdp buffer allocated!");
 		return -ENOMEM;
 	}
-	if(server->server_media.my_sdp_content_len == 0 || *server->server_media.my_sdp == '\0')
-		rtsp_create_sdp(server);
-	sprintf(response, RTSP_RES_OK CRLF \
-						"CSeq: %d" CRLF \
-						"Content-Type: application/sdp" CRLF \
-						"Content-Base: rtsp://%d.%d.%d.%d/test.sdp" CRLF \
-						"Content-Length: %d" CRLF \
-						CRLF \
-						"%s", server->CSeq_now, server->server_ip[0], server->server_ip[1], server->server_ip[2], server->server_ip[3], server->server_media.my_sdp_content_len, server->server_media.my_sdp);
-        //rtsp_res_dump(response, strlen(response));	
-        return write(server->client_socket, response, strlen(response));
-}
-
-int rtsp_on_req_GET_PARAMETER(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
-{
-	u8 response[512] = {0};
-	if(server->CSeq_now > server->message.CSeq)
+	if(media->my_sdp_version != ATOMIC_READ(&media->sdp_version))
+		rtsp_sm_session_build_sdp(media);
+	//only the session level c= line depends on client
+	sdp_writer_init(&w, c_line, sizeof(c_line));
+	sdp_fill_c_field(&w, (u8 *)"IN", (u8 *)"IP4", conn->client_ip, conn->message.transport.ttl);
+	rtsp_res_status(&res, RTSP_RES_OK, conn->CSeq_now);
+	rtsp_res_add_hdr(&res, RTSP_HDR_CONTENT_TYPE);
+	rtsp_res_add_lit(&res, "application/sdp" CRLF);
+	rtsp_res_add_hdr(&res, RTSP_HDR_CONTENT_BASE);
+	rtsp_res_add_lit(&res, "rtsp://");
+	rtsp_res_add_ip(&res, server->server_ip);
+	rtsp_res_add_lit(&res, "/test.sdp" CRLF);
+	rtsp_res_add_hdr(&res, RTSP_HDR_CONTENT_LENGTH);
+	rtsp_res_add_u32(&res, media->my_sdp_content_len + w.len);
+	rtsp_res_add_lit(&res, CRLF CRLF);
+	//sdp body is sent from the session buffer, not copied
+	rtsp_res_add(&res, media->my_sdp, media->my_sdp_c_off);
+	rtsp_res_add(&res, c_line, w.len);
+	rtsp_res_add(&res, media->my_sdp + media->my_sdp_c_off, media->my_sdp_content_len - media->my_sdp_c_off);
+        return rtsp_client_conn_send_response(conn, &res);
+}
+
+int rtsp_on_req_GET_PARAMETER(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
+{
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
+	if(conn->CSeq_now > conn->message.CSeq)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;       
+	conn->CSeq_now = conn->message.CSeq;       
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);	
-	sprintf(response, RTSP_RES_OK CRLF \
-						"CSeq: %d" CRLF \
-						"Session: %x:timeout=%d" CRLF\
-						CRLF, server->CSeq_now, server->server_media.session_info.session_id, server->server_media.session_info.session_timeout);
-        //rtsp_res_dump(response, strlen(response));
-        return write(server->client_socket, response, strlen(response));							
+	rtsp_res_status(&res, RTSP_RES_OK, conn->CSeq_now);
+	rtsp_res_add_session(&res, conn, 1);
+	rtsp_res_add_lit(&res, CRLF);
+        return rtsp_client_conn_send_response(conn, &res);							
 }
 
 void rtsp_set_rtp_task(rtsp_sm_subsession *subsession, void (*rtp_task_handle)(void *ctx))
@@ -991,17 +1542,86 @@ void rtsp_set_rtp_task(rtsp_sm_subsession *subsession, void (*rtp_task_handle)(v
 	subsession->rtp_task_handle = rtp_task_handle;
 }
 
+//hand subsession to the sender pool, caller must hold subsession client lock
 int rtsp_start_rtp_task(rtsp_sm_subsession *subsession)
 {
-	if(xTaskCreate(subsession->rtp_task_handle, ((const signed char*)"rtp_s_service"), 2048, (void *)subsession, RTP_SERVICE_PRIORITY, subsession->task_id) != pdPASS)
+	p_rtsp_sm_session session = subsession->parent_session;
+	struct rtsp_server *server = (struct rtsp_server *)session->parent_server;
+	if(ATOMIC_READ(&server->worker_cnt) == 0)
 	{
-		RTSP_ERROR("\n\rrtp session %d service: Create Task Error\n", subsession->id);
-		return -1;;
-	}	
+		RTSP_ERROR("\n\rno rtp worker for subsession %d", subsession->id);
+		return -EPERM;
+	}
+	subsession->is_running = 1;
+	rtw_mutex_get(&server->work_lock);
+	list_add_tail(&subsession->work_anchor, &server->work_list);
+	rtw_mutex_put(&server->work_lock);
+	rtw_up_sema(&server->work_sema);
 	return 0;
 }
 
-static void rtsp_transport_check_fix(struct rtsp_transport *transport)
+//pool worker, serves one subsession at a time for as long as it has viewers
+static void rtp_worker(void *ctx)
+{
+	struct rtsp_server *server = (struct rtsp_server *)ctx;
+	rtsp_sm_subsession *subsession;
+	while(1)
+	{
+		rtw_down_sema(&server->work_sema);
+		if(server->worker_exit)
+			break;
+		subsession = NULL;
+		rtw_mutex_get(&server->work_lock);
+		if(!list_empty(&server->work_list))
+		{
+			subsession = list_first_entry(&server->work_list, rtsp_sm_subsession, work_anchor);
+			list_del_init(&subsession->work_anchor);
+			server->work_cnt++;
+		}
+		rtw_mutex_put(&server->work_lock);
+		if(subsession != NULL)
+			subsession->rtp_task_handle((void *)subsession);
+	}
+	ATOMIC_DEC(&server->worker_cnt);
+	vTaskDelete(NULL);
+}
+
+static int rtsp_server_start_workers(struct rtsp_server *server)
+{
+	int i;
+	server->worker_exit = 0;
+	//workers of a previous launch are still parked on the semaphore
+	for(i = ATOMIC_READ(&server->worker_cnt); i < server->worker_nb; i++)
+	{
+		ATOMIC_INC(&server->worker_cnt);
+		if(xTaskCreate(rtp_worker, ((const signed char*)"rtp_s_service"), RTP_SERVICE_STACK_SIZE, (void *)server, RTP_SERVICE_PRIORITY, NULL) != pdPASS)
+		{
+			ATOMIC_DEC(&server->worker_cnt);
+			RTSP_ERROR("\n\rrtp worker %d: Create Task Error\n", i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+//ask idle workers to exit and wait for them, busy ones leave once their subsession stops
+//return -ETIMEDOUT if some are still alive after timeout_ms
+static int rtsp_server_stop_workers(struct rtsp_server *server, int timeout_ms)
+{
+	int i;
+	server->worker_exit = 1;
+	for(i = 0; i < server->worker_nb; i++)
+		rtw_up_sema(&server->work_sema);
+	while(ATOMIC_READ(&server->worker_cnt) > 0 && timeout_ms > 0)
+	{
+		rtw_msleep_os(10);
+		timeout_ms -= 10;
+	}
+	return (ATOMIC_READ(&server->worker_cnt) > 0) ? -ETIMEDOUT : 0;
+}
+
+//fill defaults and claim missing port pairs, nothing stays claimed on failure
+static int rtsp_transport_check_fix(struct rtsp_transport *transport)
 {
         int tmp = 0;
         //check unconfigured fields and set default value here
@@ -1009,34 +1629,36 @@ static void rtsp_transport_check_fix(struct rtsp_transport *transport)
                 transport->proto = TRANS_PROTO_RTP;
         if(transport->lower_proto == TRANS_LOWER_PROTO_UNKNOWN)
                 transport->lower_proto = TRANS_LOWER_PROTO_UDP;
-        if(transport->cast_mode == UNICAST_MODE)
+        if(transport->cast_mode == UNICAST_MODE && transport->lower_proto == TRANS_LOWER_PROTO_TCP)
+        {
+                //rtp and rtcp are carried on rtsp connection, no udp port needed
+                if(transport->interleaved_odd == 0)
+                        transport->interleaved_odd = transport->interleaved_even + 1;
+        }else if(transport->cast_mode == UNICAST_MODE)
         {
                 if(transport->client_port_even == 0 || transport->client_port_odd == 0)
                 {
-
-                        rtw_mutex_get(&client_lower_port_lock);
-                        tmp = rtsp_get_port(CLIENT_LOWER_PORT_BASE, 8, &client_lower_port_bitmap);
-                        rtw_mutex_put(&client_lower_port_lock);
-                        transport->client_port_even = (tmp%2) ? tmp+1 : tmp;
-                        transport->client_port_odd = transport->client_port_even + 1;
-                }
-                if(transport->server_port_even == 0 || transport->server_port_odd == 0)
-                {
-                        rtw_mutex_get(&server_lower_port_lock);
-                        tmp = rtsp_get_port(SERVER_LOWER_PORT_BASE, 8, &server_lower_port_bitmap);
-                        rtw_mutex_put(&server_lower_port_lock);
-                        transport->server_port_even = (tmp%2) ? tmp+1 : tmp;
-                        transport->server_port_odd = transport->server_port_even + 1;
+                        if((tmp = rtp_port_pair_get(&client_port_range)) < 0)
+                        {
+                                RTSP_WARN("no client port pair left");
+                                return tmp;
+                        }
+                        transport->client_port_even = tmp;
+                        transport->client_port_odd = tmp + 1;
+                        transport->port_claimed |= RTSP_PORT_CLAIMED_CLIENT;
                 }
         }else if(transport->cast_mode == MULTICAST_MODE)
         {
                 if(transport->port_even == 0 || transport->port_odd == 0)
                 {
-                        rtw_mutex_get(&lower_port_lock);
-                        tmp = rtsp_get_port(LOWER_PORT_BASE, 8, &lower_port_bitmap);
-                        rtw_mutex_put(&lower_port_lock);
-                        transport->port_even = (tmp%2) ? tmp+1 : tmp;
-                        transport->port_odd = transport->port_even + 1;						
+                        if((tmp = rtp_port_pair_get(&mcast_port_range)) < 0)
+                        {
+                                RTSP_WARN("no multicast port pair left");
+                                return tmp;
+                        }
+                        transport->port_even = tmp;
+                        transport->port_odd = tmp + 1;
+                        transport->port_claimed |= RTSP_PORT_CLAIMED_MCAST;
                 }
                 if(transport->ttl == 0 || transport->ttl >256)
                         transport->ttl = 1;
@@ -1047,198 +1669,309 @@ static void rtsp_transport_check_fix(struct rtsp_transport *transport)
                 if(transport->ssrc < 0x10000000)
                         transport->ssrc += 0x10000000;
         }        
+        return 0;
 }
 
-int rtsp_on_req_SETUP(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
+int rtsp_on_req_SETUP(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
 {
-	u8 response[512] = {0};
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
 	p_rtsp_sm_subsession subsession = NULL;
+	rtsp_cc_session *c = NULL;
 	int iter_cnt = 0;
-	if(server->CSeq_now > server->message.CSeq)
+	if(conn->CSeq_now > conn->message.CSeq)
 		return -EINVAL;
-	server->CSeq_now = server->message.CSeq;        
-	if(server->state_now != RTSP_INIT)
+	conn->CSeq_now = conn->message.CSeq;        
+	if(conn->state_now != RTSP_INIT)
 	{
 		RTSP_WARN("illogical request!");
 		return -EINVAL;
 	}
+	if(conn->session_info.session_id == 0)
+		rtsp_session_info_set(&conn->session_info, 0, 0, NULL, NULL, NULL, 0, 0, 0);
 	//need to clear msg record port after we copy it to respective subsession 
 	list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
 	{
 		iter_cnt++;
-		if(!subsession->client.is_handled)
+		if(!conn->bind[subsession->id].is_handled)
 		{
-			subsession->client.client_socket = server->client_socket;
-			subsession->client.client_ip = server->client_ip;
-			memcpy(&subsession->client.transport, &server->message.transport, sizeof(struct rtsp_transport));
-                        rtsp_transport_check_fix(&subsession->client.transport);
-                        //rtsp_transport_dump(&subsession->client.transport);
-			//set default unicast mode for testing
-			rtsp_set_rtp_task(subsession, rtp_unicast_service);
+			c = &conn->bind[subsession->id];
+			//allocate before the binding is touched, failure leaves it as it was
+			if(conn->message.transport.lower_proto == TRANS_LOWER_PROTO_TCP && c->tcp_buf == NULL \
+			   && (c->tcp_buf = malloc(RTP_TCP_COALESCE_SIZE)) == NULL)
+			{
+				RTSP_ERROR("allocate interleaved buffer failed");
+				rtsp_res_status(&res, RTSP_RES_UNAVAILABLE, conn->CSeq_now);
+				rtsp_res_add_lit(&res, CRLF);
+				return rtsp_client_conn_send_response(conn, &res);
+			}
+			c->client_socket = conn->client_socket;
+			c->client_ip = conn->client_ip;
+			memcpy(&c->transport, &conn->message.transport, sizeof(struct rtsp_transport));
+			if(c->transport.lower_proto == TRANS_LOWER_PROTO_TCP)
+			{
+				//client left channel choice to us, use one pair per subsession
+				if(c->transport.interleaved_even == 0 && c->transport.interleaved_odd == 0)
+					c->transport.interleaved_even = 2 * subsession->id;
+				c->tcp_buf_len = 0;
+				c->tcp_stall_time = 0;
+				c->tcp_drop_cnt = 0;
+			}
+			//all viewers of one subsession share the server port pair of its rtp task
+			rtw_mutex_get(&subsession->client_lock);
+			c->transport.port_claimed = 0;
+                        if(rtsp_sm_subsession_get_server_port(subsession) < 0 || rtsp_transport_check_fix(&c->transport) < 0)
+			{
+				//pair claimed for a first viewer that did not make it
+				if(subsession->client_cnt == 0 && !subsession->is_running)
+					rtsp_sm_subsession_put_server_port(subsession);
+				rtw_mutex_put(&subsession->client_lock);
+				memset(&c->transport, 0, sizeof(struct rtsp_transport));
+				rtsp_res_status(&res, RTSP_RES_UNAVAILABLE, conn->CSeq_now);
+				rtsp_res_add_lit(&res, CRLF);
+				return rtsp_client_conn_send_response(conn, &res);
+			}
+			c->transport.server_port_even = subsession->server_port_even;
+			c->transport.server_port_odd = subsession->server_port_odd;
+			rtw_mutex_put(&subsession->client_lock);
+			if(c->transport.cast_mode == MULTICAST_MODE)
+				rtsp_sm_subsession_join_group(subsession, &c->transport);
+			rtsp_sm_subsession_open_rtcp(subsession);
+                        //rtsp_transport_dump(&c->transport);
+			rtw_get_random_bytes(&c->seq_no, sizeof(c->seq_no));
+			rtw_get_random_bytes(&c->ts_offset, sizeof(c->ts_offset));
+			//the first viewer decides the sender flavour, both serve all bindings of subsession
+			if(!subsession->is_running)
+				rtsp_set_rtp_task(subsession, (c->transport.cast_mode == MULTICAST_MODE) ? rtp_multicast_service : rtp_unicast_service);
 			//rtsp_set_media_handle(subsession);
-			subsession->client.is_handled = 1;
+			rtsp_sm_subsession_bind(subsession, c);
+			c->is_handled = 1;
                         printf("\n\rsubsession %d handled", subsession->id);
 			break;
 		}
 	}
-	if(iter_cnt >= ATOMIC_READ(&server->server_media.subsession_cnt) && subsession->client.is_handled)
-		server->state_now = RTSP_READY;
-	memset(&server->message.transport, 0, sizeof(struct rtsp_transport));
+	if(c == NULL)
+	{
+		RTSP_WARN("no subsession left to setup!");
+		return -EINVAL;
+	}
+	if(iter_cnt >= ATOMIC_READ(&server->server_media.subsession_cnt))
+		rtsp_client_conn_set_state(conn, RTSP_READY);
+	memset(&conn->message.transport, 0, sizeof(struct rtsp_transport));
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);	
-	if(subsession->client.transport.cast_mode == UNICAST_MODE )
+	rtsp_res_status(&res, RTSP_RES_OK, conn->CSeq_now);
+	rtsp_res_add_session(&res, conn, 1);
+	if(c->transport.cast_mode == UNICAST_MODE )
 	{
-		if(subsession->client.transport.lower_proto == TRANS_LOWER_PROTO_UDP)
+		if(c->transport.lower_proto == TRANS_LOWER_PROTO_UDP)
 		{
-			sprintf(response, RTSP_RES_OK CRLF \
-                                          "CSeq: %d" CRLF \
-                                          "Session: %x:timeout=%d" CRLF \
-                                          "Transport: RTP/AVP/UDP;%s;client_port=%d-%d;server_port=%d-%d;ssrc=%x;mode=\"PLAY\"" CRLF \
-                                          CRLF, server->CSeq_now, server->server_media.session_info.session_id, server->server_media.session_info.session_timeout, \
-                                          STR_UNICAST, subsession->client.transport.client_port_even, subsession->client.transport.client_port_odd, \
-                                          subsession->client.transport.server_port_even, subsession->client.transport.server_port_odd, subsession->client.transport.ssrc);
-		}else if(subsession->client.transport.lower_proto == TRANS_LOWER_PROTO_TCP)
+			rtsp_res_add_hdr(&res, RTSP_HDR_TRANSPORT);
+			rtsp_res_add_lit(&res, "RTP/AVP/UDP;" STR_UNICAST ";client_port=");
+			rtsp_res_add_u32(&res, c->transport.client_port_even);
+			rtsp_res_add_lit(&res, "-");
+			rtsp_res_add_u32(&res, c->transport.client_port_odd);
+			rtsp_res_add_lit(&res, ";server_port=");
+			rtsp_res_add_u32(&res, c->transport.server_port_even);
+			rtsp_res_add_lit(&res, "-");
+			rtsp_res_add_u32(&res, c->transport.server_port_odd);
+		}else if(c->transport.lower_proto == TRANS_LOWER_PROTO_TCP)
 		{
-			sprintf(response, RTSP_RES_OK CRLF \
-                                          "CSeq: %d" CRLF \
-                                          "Session: %x:timeout=%d" CRLF \
-                                          "Transport: RTP/AVP/TCP;%s;client_port=%d-%d;server_port=%d-%d;ssrc=%x;mode=\"PLAY\"" CRLF \
-                                          CRLF, server->CSeq_now, server->server_media.session_info.session_id, server->server_media.session_info.session_timeout, \
-                                          STR_UNICAST, subsession->client.transport.client_port_even, subsession->client.transport.client_port_odd, \
-                                          subsession->client.transport.server_port_even, subsession->client.transport.server_port_odd, subsession->client.transport.ssrc);			
+			rtsp_res_add_hdr(&res, RTSP_HDR_TRANSPORT);
+			rtsp_res_add_lit(&res, "RTP/AVP/TCP;" STR_UNICAST ";interleaved=");
+			rtsp_res_add_u32(&res, c->transport.interleaved_even);
+			rtsp_res_add_lit(&res, "-");
+			rtsp_res_add_u32(&res, c->transport.interleaved_odd);
 		}else{
 			RTSP_ERROR("missing param1!");
 			return -EINVAL;			
 		}
-	}else if(subsession->client.transport.cast_mode == MULTICAST_MODE)
+	}else if(c->transport.cast_mode == MULTICAST_MODE)
 	{
-			sprintf(response, RTSP_RES_OK CRLF \
-                                          "CSeq: %d" CRLF \
-                                          "Session: %x:timeout=%d" CRLF \
-                                          "Transport: RTP/AVP/UDP;%s;port=%d-%d;ttl=%d;ssrc=%x;mode=\"PLAY\"" CRLF \
-                                          CRLF, server->CSeq_now, server->server_media.session_info.session_id, server->server_media.session_info.session_timeout, \
-                                          STR_MULTICAST, subsession->client.transport.port_even, subsession->client.transport.port_odd, subsession->client.transport.ttl, subsession->client.transport.ssrc);		
+			rtsp_res_add_hdr(&res, RTSP_HDR_TRANSPORT);
+			rtsp_res_add_lit(&res, "RTP/AVP/UDP;" STR_MULTICAST ";destination=");
+			rtsp_res_add_ip(&res, (u8 *)&subsession->mcast_addr);
+			rtsp_res_add_lit(&res, ";port=");
+			rtsp_res_add_u32(&res, c->transport.port_even);
+			rtsp_res_add_lit(&res, "-");
+			rtsp_res_add_u32(&res, c->transport.port_odd);
+			rtsp_res_add_lit(&res, ";ttl=");
+			rtsp_res_add_u32(&res, c->transport.ttl);
 	}else{
 		RTSP_ERROR("missing param2!");
 		return -EINVAL;		
 	}
-        //rtsp_res_dump(response, strlen(response));        
-	return write(server->client_socket, response, strlen(response));	
+	rtsp_res_add_lit(&res, ";ssrc=");
+	rtsp_res_add_hex(&res, c->transport.ssrc);
+	rtsp_res_add_lit(&res, ";mode=\"PLAY\"" CRLF CRLF);
+	return rtsp_client_conn_send_response(conn, &res);
 }
 
-int rtsp_on_req_PLAY(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
+//every bound sender streams, the deferred PLAY can be answered
+static int rtsp_client_conn_armed(rtsp_client_conn *conn)
 {
-	u8 response[128] = {0};
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	p_rtsp_sm_subsession subsession = NULL;
+	list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
+	{
+		if(conn->bind[subsession->id].is_handled && subsession->sender_state != RTP_SENDER_STREAMING)
+			return 0;
+	}
+	return 1;
+}
+
+//answer deferred PLAY, 200 once armed, otherwise 503 and back to READY
+static int rtsp_client_conn_play_reply(rtsp_client_conn *conn, int armed)
+{
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
+	conn->play_pending = 0;
+	server->play_pending_cnt--;
+	if(armed)
+	{
+		RTSP_INFO("rtp session start");
+		rtsp_res_status(&res, RTSP_RES_OK, conn->play_cseq);
+	}else{
+		RTSP_WARN("senders of session %x not armed", conn->session_info.session_id);
+		rtsp_client_conn_set_state(conn, RTSP_READY);
+		rtsp_res_status(&res, RTSP_RES_UNAVAILABLE, conn->play_cseq);
+	}
+	rtsp_res_add_session(&res, conn, 0);
+	rtsp_res_add_lit(&res, CRLF);
+	return rtsp_client_conn_send_response(conn, &res);
+}
+
+//run by server task after each reactor round while a PLAY reply is deferred
+static void rtsp_server_play_pending(struct rtsp_server *server)
+{
+	rtsp_client_conn *conn;
+	int i, armed;
+	for(i = 0; i < server->max_client_nb; i++)
+	{
+		conn = server->conn_table[i];
+		if(conn == NULL || !conn->play_pending)
+			continue;
+		armed = rtsp_client_conn_armed(conn);
+		if(!armed && rtw_systime_to_ms(rtw_get_current_time() - conn->play_time) < RTP_SENDER_ARM_TIMEOUT)
+			continue;
+		if(rtsp_client_conn_play_reply(conn, armed) < 0)
+			rtsp_client_conn_free(conn);
+	}
+}
+
+int rtsp_on_req_PLAY(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
+{
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
 	p_rtsp_sm_subsession subsession = NULL;
-        int timer = 100;
 	int ret = 0;
-	if(server->CSeq_now > server->message.CSeq)
+	if(conn->CSeq_now > conn->message.CSeq)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;        
-	if(server->state_now != RTSP_READY)
+	conn->CSeq_now = conn->message.CSeq;        
+	if(conn->state_now != RTSP_READY)
 	{
 		RTSP_WARN("illogical request!");
 		return -EINVAL;
 	}
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);
-        server->state_now = RTSP_PLAYING;	
-	//start rtp session here
+	rtsp_client_conn_set_state(conn, RTSP_PLAYING);
+	//queue subsession to sender pool if this is the first viewer, a paused sender was kicked by the state change
 	list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
 	{
-#if 1
-                rtp_sink_packet_init(subsession->sink);
-		ret = rtsp_start_rtp_task(subsession);
+		if(!conn->bind[subsession->id].is_handled)
+			continue;
+		rtw_mutex_get(&subsession->client_lock);
+		if(!subsession->is_running)
+		{
+			rtp_sink_packet_init(subsession->sink);
+			ret = rtsp_start_rtp_task(subsession);
+		}
+		rtw_mutex_put(&subsession->client_lock);
 		if(ret < 0)
 		{
-			//do we need to clear resource record here?
-			//server->state_now = RTSP_INIT;
-			return -1;
+			RTSP_WARN("subsession %d sender not queued", subsession->id);
+			rtsp_client_conn_set_state(conn, RTSP_READY);
+			rtsp_res_status(&res, RTSP_RES_UNAVAILABLE, conn->CSeq_now);
+			rtsp_res_add_session(&res, conn, 0);
+			rtsp_res_add_lit(&res, CRLF);
+			return rtsp_client_conn_send_response(conn, &res);
 		}
-#endif
 	}
-        while(ATOMIC_READ(&server->server_media.reference_cnt) < ATOMIC_READ(&server->server_media.subsession_cnt))
-        {
-            rtw_msleep_os(10);
-            if(--timer <= 0)
-            {
-                server->state_now = RTSP_INIT;
-                sprintf(response, RTSP_RES_SNF CRLF \
-                                                        "CSeq: %d" CRLF \
-                                                        "Session: %x" CRLF \
-                                                        CRLF, server->CSeq_now, server->server_media.session_info.session_id);	
-                return write(server->client_socket, response, strlen(response));                
-            }   
-        }
-        
-	RTSP_INFO("rtp session start");
-	sprintf(response, RTSP_RES_OK CRLF \
-						"CSeq: %d" CRLF \
-						"Session: %x" CRLF \
-						CRLF, server->CSeq_now, server->server_media.session_info.session_id);
-        //rtsp_res_dump(response, strlen(response));	
-        return write(server->client_socket, response, strlen(response));
+	//reply once senders stream, usually one context switch away, from server task so that
+	//other connections are not held up meanwhile
+	conn->play_pending = 1;
+	conn->play_cseq = conn->CSeq_now;
+	conn->play_time = rtw_get_current_time();
+	server->play_pending_cnt++;
+	if(rtsp_client_conn_armed(conn))
+		return rtsp_client_conn_play_reply(conn, 1);
+	return 0;
 }
 
-int rtsp_on_req_TEARDOWN(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
+int rtsp_on_req_TEARDOWN(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
 {
-	u8 response[128] = {0};
-	if(server->CSeq_now > server->message.CSeq)
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
+	if(conn->CSeq_now > conn->message.CSeq)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;        
+	conn->CSeq_now = conn->message.CSeq;        
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);	
-	server->state_now = RTSP_INIT;
-	sprintf(response, RTSP_RES_OK CRLF \
-						"CSeq: %d" CRLF \
-						"Session: %x" CRLF \
-						CRLF, server->CSeq_now, server->server_media.session_info.session_id);
-        //rtsp_res_dump(response, strlen(response));
-        return write(server->client_socket, response, strlen(response));
+	rtsp_client_conn_release(conn);
+	rtsp_res_status(&res, RTSP_RES_OK, conn->CSeq_now);
+	rtsp_res_add_session(&res, conn, 0);
+	rtsp_res_add_lit(&res, CRLF);
+        return rtsp_client_conn_send_response(conn, &res);
 }
 
-int rtsp_on_req_PAUSE(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
+int rtsp_on_req_PAUSE(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
 {
-	u8 response[128] = {0};
-	if(server->CSeq_now > server->message.CSeq)
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
+	if(conn->CSeq_now > conn->message.CSeq)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;        
+	conn->CSeq_now = conn->message.CSeq;        
+	if(conn->state_now == RTSP_INIT)
+	{
+		RTSP_WARN("illogical request!");
+		return -EINVAL;
+	}
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);	
-	server->state_now = RTSP_READY;
-	sprintf(response, RTSP_RES_OK CRLF \
-						"CSeq: %d" CRLF \
-						"Session: %x" CRLF \
-						CRLF, server->CSeq_now, server->server_media.session_info.session_id);
-        //rtsp_res_dump(response, strlen(response));	
-        return write(server->client_socket, response, strlen(response));	
+	//senders see it at once and stop after the frame in flight
+	rtsp_client_conn_set_state(conn, RTSP_READY);
+	rtsp_res_status(&res, RTSP_RES_OK, conn->CSeq_now);
+	rtsp_res_add_session(&res, conn, 0);
+	rtsp_res_add_lit(&res, CRLF);
+        return rtsp_client_conn_send_response(conn, &res);
 }
 
-int rtsp_on_req_UNDEFINED(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter))
+int rtsp_on_req_UNDEFINED(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter))
 {
-	u8 response[128] = {0};
-	if(server->CSeq_now > server->message.CSeq)
+	struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+	struct rtsp_response res;
+	if(conn->CSeq_now > conn->message.CSeq)
         {
                 RTSP_WARN("CSeq out of order");
 		return -EINVAL;
         }
-	server->CSeq_now = server->message.CSeq;        
+	conn->CSeq_now = conn->message.CSeq;        
 	if(rtsp_req_cb)
             rtsp_req_cb(server->adapter->ext_adapter);
-        server->state_now = RTSP_INIT;
-	sprintf(response, RTSP_RES_BAD CRLF \
-						"CSeq: %d" CRLF \
-						CRLF, server->CSeq_now);
-	return write(server->client_socket, response, strlen(response));	
+        rtsp_client_conn_set_state(conn, RTSP_INIT);
+	rtsp_res_status(&res, RTSP_RES_BAD, conn->CSeq_now);
+	rtsp_res_add_lit(&res, CRLF);
+	return rtsp_client_conn_send_response(conn, &res);	
 }
 
 static int rtsp_check_wifi_connectivity(const char *ifname, int *mode)
@@ -1257,23 +1990,152 @@ static int rtsp_check_wifi_connectivity(const char *ifname, int *mode)
 		return -1;
 }
 
+//read one request from client connection and respond, return negative value to close connection
+//dispatch one parsed request of connection
+static int rtsp_client_conn_dispatch(rtsp_client_conn *conn)
+{
+		struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+		struct rtsp_response res;
+		int ret;
+                //rtsp_req_dump(conn->parser.method.ptr, conn->parser.pos - conn->parser.start);
+		if(rtsp_parse_request(&conn->message, &conn->parser) < 0)
+			return -1;
+		//requests carrying a session id must refer to the session of this connection
+		if(conn->message.session_id != 0 && rtsp_server_find_session(server, conn->message.session_id) != conn)
+		{
+			RTSP_WARN("session %x not found", conn->message.session_id);
+			rtsp_res_status(&res, RTSP_RES_SNF, conn->message.CSeq);
+			rtsp_res_add_lit(&res, CRLF);
+			return rtsp_client_conn_send_response(conn, &res);
+		}
+		//client went on before senders armed, answer PLAY first so that replies stay in order
+		if(conn->play_pending && rtsp_client_conn_play_reply(conn, rtsp_client_conn_armed(conn)) < 0)
+			return -1;
+		switch(conn->message.method)
+		{
+			case(RTSP_REQ_OPTIONS):
+				ret = rtsp_on_req_OPTIONS(conn, rtsp_req_OPTIONS_cb);
+				break;
+			case(RTSP_REQ_DESCRIBE):
+				ret = rtsp_on_req_DESCRIBE(conn, rtsp_req_DESCRIBE_cb);
+				break;
+			case(RTSP_REQ_GET_PARAMETER):
+				ret = rtsp_on_req_GET_PARAMETER(conn, rtsp_req_GET_PARAMETER_cb);
+				break;
+			case(RTSP_REQ_SETUP):
+				ret = rtsp_on_req_SETUP(conn, rtsp_req_SETUP_cb);
+				break;
+			case(RTSP_REQ_PLAY):
+				ret = rtsp_on_req_PLAY(conn, rtsp_req_PLAY_cb);
+				break;
+			case(RTSP_REQ_TEARDOWN):
+				ret = rtsp_on_req_TEARDOWN(conn, rtsp_req_TEARDOWN_cb);
+				break;
+			case(RTSP_REQ_PAUSE):
+				ret = rtsp_on_req_PAUSE(conn, rtsp_req_PAUSE_cb);
+				break;
+			default:
+				ret = rtsp_on_req_UNDEFINED(conn, rtsp_req_UNDEFINED_cb);
+				break;
+		}
+		if(ret < 0)
+			RTSP_ERROR("\n\rrtsp send response failed - err code:%d", ret);
+		return ret;
+}
+
+//read whatever arrived and serve every request completed by it, partial requests wait for more bytes
+static int rtsp_client_conn_serve(rtsp_client_conn *conn)
+{
+		int ret, room;
+		u8 *space = rtsp_parser_space(&conn->parser, &room);
+		if(room <= 0)
+			return -ENOMEM;
+		ret = read(conn->client_socket, space, room);
+		if(ret <= 0)
+			return -1;
+		//requests and interleaved rtcp both arrive here
+		rtsp_client_conn_touch(conn);
+		rtsp_parser_commit(&conn->parser, ret);
+		while((ret = rtsp_parser_next(&conn->parser)) == RTSP_PARSE_DONE)
+		{
+			if(rtsp_client_conn_dispatch(conn) < 0)
+				return -1;
+		}
+		return ret;
+}
+
+static void rtsp_server_close_all_conn(struct rtsp_server *server)
+{
+		int i;
+		for(i = 0; i < server->max_client_nb; i++)
+		{
+			if(server->conn_table[i] != NULL)
+				rtsp_client_conn_free(server->conn_table[i]);
+		}
+}
+
+//interleaved viewers a sender gave up on, their stream is no longer framed
+static void rtsp_server_close_broken(struct rtsp_server *server)
+{
+		int i;
+		for(i = 0; i < server->max_client_nb; i++)
+		{
+			if(server->conn_table[i] != NULL && server->conn_table[i]->tx_broken)
+				rtsp_client_conn_free(server->conn_table[i]);
+		}
+}
+
+static void rtsp_server_on_request(int fd, int events, void *ctx)
+{
+		rtsp_client_conn *conn = (rtsp_client_conn *)ctx;
+		struct rtsp_server *server = (struct rtsp_server *)conn->parent_server;
+		if((events & REACTOR_EV_ERROR) || rtsp_client_conn_serve(conn) < 0)
+			rtsp_client_conn_free(conn);
+}
+
+static void rtsp_server_on_accept(int fd, int events, void *ctx)
+{
+		struct rtsp_server *server = (struct rtsp_server *)ctx;
+		rtsp_client_conn *conn;
+		struct sockaddr_in client_addr;
+		socklen_t client_addr_len = sizeof(struct sockaddr_in);
+		int opt = 1;
+#if defined(__linux__)
+		struct timeval send_timeout = {RTSP_SEND_TIMEOUT / 1000, (RTSP_SEND_TIMEOUT % 1000) * 1000};
+#else
+		int send_timeout = RTSP_SEND_TIMEOUT; //lwIP takes ms, stacks without LWIP_SO_SNDTIMEO ignore it
+#endif
+		int client_socket = accept(fd, (struct sockaddr*)&client_addr, &client_addr_len);
+		if(client_socket < 0)
+		{
+			RTSP_ERROR("\n\rcleint socket error");
+			return;
+		}
+		//responses are small and latency bound
+		setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&opt, sizeof(opt));
+		//a reply to a viewer that stopped reading must not hold the reactor and write lock for good
+		setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&send_timeout, sizeof(send_timeout));
+		if((conn = rtsp_client_conn_create(server, client_socket, client_addr.sin_addr.s_addr)) == NULL)
+		{
+			close(client_socket);
+			return;
+		}
+		if(rtsp_reactor_add(&server->reactor, client_socket, REACTOR_EV_READ, rtsp_server_on_request, (void *)conn) < 0)
+		{
+			//client socket is not watched yet, free closes it
+			rtsp_client_conn_free(conn);
+			return;
+		}
+                //printf("\n\rclient ip:%x", client_addr.sin_addr.s_addr);
+}
+
 void rtsp_server_service(void *ctx)
 {
 		struct rtsp_server *server = (struct rtsp_server *)ctx;
-		u8 *request;
 		int opt = 1;
 		int mode = 0;
-		int ret;
-		u32 time_base, time_now;
-		struct sockaddr_in server_addr, client_addr;
-                socklen_t client_addr_len = sizeof(struct sockaddr_in);
-		fd_set server_read_fds, client_read_fds;
-		struct timeval s_listen_timeout, c_listen_timeout;
-                if((request = malloc(REQUEST_BUF_SIZE)) == NULL)
-                {
-                        RTSP_ERROR("rtsp request buffer allocate fail");
-                        goto exit;
-                }
+		u32 time_base, time_now, last_check;
+		struct sockaddr_in server_addr;
 //first check wifi connectivity
 restart:
 		time_base = rtw_get_current_time();
@@ -1288,6 +2150,9 @@ restart:
                         rtw_msleep_os(10);
 		}
 //socket init
+		if(rtsp_reactor_init(&server->reactor) < 0)
+				goto exit;
+		rtsp_reaper_init(&server->reaper);
 		server->server_socket = socket(AF_INET, SOCK_STREAM, 0);
 		if(server->server_socket < 0)
 		{
@@ -1307,103 +2172,42 @@ restart:
 			RTSP_ERROR("\n\rcannot bind stream socket");
 			goto exit1;
 		}
-		listen(server->server_socket, 1);
+		listen(server->server_socket, RTSP_LISTEN_BACKLOG);
+		if(rtsp_reactor_add(&server->reactor, server->server_socket, REACTOR_EV_READ, rtsp_server_on_accept, (void *)server) < 0)
+			goto exit1;
                 //indicate server launched
                 server->is_launched = 1;
                 RTSP_WARN("rtsp server start...");
-		//enter service loop
+		//enter service loop, reactor dispatches accept, requests and rtcp as they become ready
+		last_check = rtw_get_current_time();
 		while(server->is_launched)
 		{
-			ret = 0;
-			FD_ZERO(&server_read_fds);
-			s_listen_timeout.tv_sec = 1;
-			s_listen_timeout.tv_usec = 0;
-			FD_SET(server->server_socket, &server_read_fds);
-			if(select(RTSP_SELECT_SOCK, &server_read_fds, NULL, NULL, &s_listen_timeout))
-			{
-				server->client_socket = accept(server->server_socket, (struct sockaddr*)&client_addr, &client_addr_len);
-				if(server->client_socket < 0)
-				{
-					RTSP_ERROR("\n\rcleint socket error");
-					close(server->client_socket);
-					continue;
-				}
-				//load client ip address from client_addr
-				*(u32 *)server->client_ip = client_addr.sin_addr.s_addr;
-                                //printf("\n\rclient ip:%x", *(u32 *)server->client_ip);
-				//enter negotiation process
-				while(server->is_launched)
-				{
-					FD_ZERO(&client_read_fds);
-					c_listen_timeout.tv_sec = 0;
-					c_listen_timeout.tv_usec = 10000;
-					FD_SET(server->client_socket, &client_read_fds);
-					
-					if(select(RTSP_SELECT_SOCK, &client_read_fds, NULL, NULL, &c_listen_timeout))
-					{
-						memset(request, 0, REQUEST_BUF_SIZE);
-						ret = read(server->client_socket, request, REQUEST_BUF_SIZE);
-                                                //rtsp_req_dump(request, ret);
-						//check and parse request
-						//if(rtsp_parse_request(&server->message, request, ret) == -EAGAIN)
-                                                //  continue;
-                                                if(rtsp_parse_request(&server->message, request, ret) < 0)
-                                                    goto out;
-                                                switch(server->message.method)
-                                                {
-                                                        case(RTSP_REQ_OPTIONS):
-                                                                ret = rtsp_on_req_OPTIONS(server, rtsp_req_OPTIONS_cb);
-                                                                break;
-                                                        case(RTSP_REQ_DESCRIBE):
-                                                                ret = rtsp_on_req_DESCRIBE(server, rtsp_req_DESCRIBE_cb);
-                                                                break;
-                                                        case(RTSP_REQ_GET_PARAMETER):
-                                                                ret = rtsp_on_req_GET_PARAMETER(server, rtsp_req_GET_PARAMETER_cb);
-                                                                break;
-                                                        case(RTSP_REQ_SETUP):
-                                                                ret = rtsp_on_req_SETUP(server, rtsp_req_SETUP_cb);
-                                                                break;
-                                                        case(RTSP_REQ_PLAY):
-                                                                ret = rtsp_on_req_PLAY(server, rtsp_req_PLAY_cb);
-                                                                break;
-                                                        case(RTSP_REQ_TEARDOWN):
-                                                                ret = rtsp_on_req_TEARDOWN(server, rtsp_req_TEARDOWN_cb);
-                                                                break;
-                                                        case(RTSP_REQ_PAUSE):
-                                                                ret = rtsp_on_req_PAUSE(server, rtsp_req_PAUSE_cb);
-                                                                break;
-                                                        default:
-                                                                ret = rtsp_on_req_UNDEFINED(server, rtsp_req_UNDEFINED_cb);
-                                                                break;
-                                                }
-                                                if(ret < 0)
-                                                {
-                                                                RTSP_ERROR("\n\rrtsp send response failed - err code:%d", ret);
-                                                                goto out;
-                                                }
-					}
-					if(rtsp_check_wifi_connectivity(WLAN0_NAME, &mode) < 0)
-						goto out;
-				}
-out:			
-				close(server->client_socket);
-                                rtsp_sm_session_refresh(&server->server_media);
-				server->state_now = RTSP_INIT;				
-			}
-			
+			//a sender that starts streaming wakes us while a PLAY reply is deferred
+			rtsp_reactor_run_once(&server->reactor, (server->play_pending_cnt > 0) ? RTSP_PLAY_POLL_MS : RTSP_REACTOR_TICK_MS);
+			if(server->play_pending_cnt > 0)
+				rtsp_server_play_pending(server);
+			//housekeeping at most once per tick no matter how busy the control plane is
+			time_now = rtw_get_current_time();
+			if(rtw_systime_to_ms(time_now - last_check) < RTSP_REACTOR_TICK_MS)
+				continue;
+			last_check = time_now;
+			rtsp_server_reap(server);
+			rtsp_server_close_broken(server);
 			if(rtsp_check_wifi_connectivity(WLAN0_NAME, &mode) < 0)
 			{
 				RTSP_WARN("\n\rwifi Tx/Rx broke!");
+				rtsp_server_close_all_conn(server);
 				close(server->server_socket);
+				rtsp_reactor_deinit(&server->reactor);
 				RTSP_WARN("\n\rRTSP server restart in %ds...", rtsp_launch_timeout/1000);
 				goto restart;
 			}
-			rtw_msleep_os(1000);
 		}
 exit1:
 		rtsp_server_stop(server);
+		rtsp_server_close_all_conn(server);
 		close(server->server_socket);
-                free(request);
+		rtsp_reactor_deinit(&server->reactor);
                 RTSP_WARN("rtsp server stop...");
 exit:                
 		vTaskDelete(NULL);
@@ -1431,6 +2235,10 @@ int rtsp_server_launch(struct rtsp_server *server)
 			RTSP_WARN("\n\rserver not set up (permission denied)");
 			return -1;
 		}
+		//sender pool first, PLAY only queues work to it
+		server->worker_nb = server->server_media.max_subsession_nb;
+		if(rtsp_server_start_workers(server) < 0)
+			goto error;
 		//start rtsp server task
 		rtsp_server_set_launch_handle(server, &rtsp_server_service);
 		if(xTaskCreate(*server->launch_handle, ((const signed char*)"rtsp_s_service"), 1024, (void *)server, RTSP_SERVICE_PRIORITY, server->rtsp_task_id) != pdPASS)
@@ -1441,13 +2249,21 @@ int rtsp_server_launch(struct rtsp_server *server)
 		
 		return 0;
 error:
+		//nothing was queued yet, workers left over are parked and exit when they wake up
+		rtsp_server_stop_workers(server, RTP_WORKER_EXIT_TIMEOUT);
 		server->rtsp_task_id = NULL;
 		return -1;
 }
 
 void rtsp_server_stop(struct rtsp_server *server)
 {
+		rtsp_sm_subsession *subsession = NULL;
 		server->is_launched = 0;
+		list_for_each_entry(subsession, &server->server_media.media_entry, media_anchor, rtsp_sm_subsession)
+		{
+			rtw_up_sema(&subsession->state_sema);
+			rtp_sink_wakeup(subsession->sink);
+		}
 }
 
 _WEAK int rtsp_req_OPTIONS_cb(void *ext_adapter)
@@ -7,6 +7,9 @@
 #include "rtsp_common.h"
 #include "rtp_sink.h"
 #include "rtp_source.h"
+#include "rtsp_reactor.h"
+#include "rtsp_parser.h"
+#include "rtsp_response.h"
 
 /*****************************************************DEFINITIONS**********************************************/
 
@@ -24,14 +27,38 @@ inline int is_line_end(u8 *x)
 #define RTSP_SELECT_SOCK 8
 #define MAX_URL_LEN	32
 #define REQUEST_BUF_SIZE	1024
+#define RTSP_FMTP_MAX		256	//codec parameters appended to a=fmtp of a subsession, fits h264 sprop of two H264_SPROP_NAL_MAX sets
 #define RESPONSE_BUF_SIZE	1024
 
-#define LOWER_PORT_BASE		51100
-#define CLIENT_LOWER_PORT_BASE 	51200
-#define SERVER_LOWER_PORT_BASE	51400
-
 #define DEF_SESSION_TIMEOUT	(60000) //in ms
 
+/* idle connection reaper, a timer wheel advanced from the server housekeeping tick */
+#define RTSP_REAP_WHEEL_SLOTS	64	//power of two
+#define RTSP_REAP_TICK_MS	1000
+#define RTSP_REAP_GRACE		5000	//in ms on top of session timeout, covers keepalives sent right at the deadline
+
+#define RTSP_IP_SIZE	4
+#define RTSP_MAX_CLIENT_DEF	8	//default concurrent rtsp connections
+#define RTSP_MAX_CLIENT_NB	32	//upper limit of rtsp connection table
+#define RTSP_LISTEN_BACKLOG	4
+#define RTCP_RECV_BUF_SIZE	256
+#define RTP_TCP_COALESCE_SIZE	8192	//interleaved frames are batched up to this size per write
+#define RTP_TCP_FRAME_HDR_SZ	4	//'$' + channel + 16 bit length
+#define RTP_TCP_FRAME_TIMEOUT	100	//in ms, a frame cut by a full send window must be finished within this
+#define RTP_TCP_STALL_TIMEOUT	3000	//in ms, interleaved viewer whose window stays closed this long is disconnected
+#define RTSP_SEND_TIMEOUT	2000	//in ms, bounds a reply to a viewer that does not read
+
+#define RTSP_MCAST_ADDR_DEF	0xEFFF0001	//239.255.0.1 in host order, subsession id is added
+
+/* sender state of a subsession */
+#define RTP_SENDER_IDLE		0	//not attached to a worker
+#define RTP_SENDER_PAUSED	1	//attached, waiting for a viewer to play
+#define RTP_SENDER_STREAMING	2	//attached and sending frames
+
+#define RTP_SENDER_RECHECK	1000	//in ms, paused sender with viewers still bound rechecks state at least this often
+#define RTP_SENDER_ARM_TIMEOUT	500	//in ms, PLAY reply waits this long for sender to start streaming, then 503
+#define RTSP_PLAY_POLL_MS	50	//reactor wait while a PLAY reply is deferred, bounds it without wakeup socket
+
 /*****************************************************STRUCTURES***********************************************/
 
 enum _rtsp_state {
@@ -41,11 +68,21 @@ enum _rtsp_state {
 };
 typedef enum _rtsp_state rtsp_state;
 
+//binding of one client connection to one media subsession
 typedef struct _rtsp_client_connection_session{
+	_list bind_anchor; //link to subsession client list
+	void *parent_conn;
 	int client_socket;
 	u8 *client_ip;
 	struct rtsp_transport transport;
+	u16 seq_no;
+	u32 ts_offset; //random rtp timestamp offset of this destination
+	u8 *tcp_buf; //coalescing buffer for interleaved transport
+	int tcp_buf_len;
+	u32 tcp_stall_time; //systime the send window was first found closed, 0 while frames get through
+	u32 tcp_drop_cnt; //coalesced buffers lost to a closed window
 	u8 is_handled;
+	u8 is_playing; //changed under subsession client lock by connection state machine only
 }rtsp_cc_session, *p_rtsp_cc_session;
 
 typedef struct _rtsp_server_media_subsession{
@@ -54,9 +91,32 @@ typedef struct _rtsp_server_media_subsession{
 	_list media_anchor;
 	rtp_source_t *src;
 	rtp_sink_t *sink;
-	rtsp_cc_session client;
-	TaskHandle_t task_id;
+	_list client_list; //rtsp_cc_session bindings fed by this subsession
+	_mutex client_lock;
+	_mutex tx_lock; //held by fan-out while writing to bindings, taken before client lock so unbind waits for it
+	int client_cnt;
+	int play_cnt; //bindings with is_playing set
+	u8 sender_state; //RTP_SENDER_*, changed under client lock
+	_sema state_sema; //kicked on every state change of a bound connection
+	u32 resume_cnt;
+	u16 server_port_even; //shared rtp/rtcp port pair of all bindings
+	u16 server_port_odd;
+	u8 server_port_claimed; //server pair is ours to release
+	u32 mcast_addr; //multicast group in network order, shared by all multicast bindings
+	u16 mcast_port_even;
+	u16 mcast_port_odd;
+	u8 mcast_ttl;
+	u8 mcast_port_claimed; //group pair is ours to release
+	int mcast_cnt; //multicast bindings attached to group
+	u16 mcast_seq_no;
+	u32 mcast_ssrc;
+	u32 mcast_ts_offset;
+	int rtcp_sock; //server side rtcp socket, watched by server reactor
+	u32 rtcp_rr_cnt; //receiver reports received
+	u8 is_running; //queued to or served by a pool worker
+	_list work_anchor; //link to server work list while waiting for a worker
 	void (*rtp_task_handle)(void *ctx); //we register rtp task here
+	char fmtp[RTSP_FMTP_MAX]; //codec parameters learned from stream for a=fmtp, guarded by client lock
 	u8* my_sdp;
 	int my_sdp_max_len;
 	int my_sdp_content_len;	
@@ -65,9 +125,13 @@ typedef struct _rtsp_server_media_subsession{
 typedef struct _rtsp_server_media_session{
 	_list media_entry;
 	void *parent_server;
+	//client independent part of sdp, the session level c= line is spliced in per client at my_sdp_c_off
 	u8* my_sdp;
 	int my_sdp_max_len;
 	int my_sdp_content_len;
+	int my_sdp_c_off;
+	u32 my_sdp_version; //sdp_version the cached sdp was built from
+	ATOMIC_T sdp_version; //bumped whenever subsessions, groups or codec parameters change
 	int max_subsession_nb;
 	ATOMIC_T subsession_cnt;
 	ATOMIC_T reference_cnt;
@@ -89,10 +153,46 @@ typedef struct _rtsp_client_media_session{
 	u32 subsession_cnt;
 }rtsp_cm_session, *p_rtsp_cm_session;
 
+//per connection session, indexed in server connection table by session id
+typedef struct _rtsp_client_connection{
+	void *parent_server;
+	int client_socket;
+	u8 client_ip[RTSP_IP_SIZE];
+	struct rtsp_message message;
+	u8 *rx_buf; //receive buffer, requests may arrive split or pipelined
+	struct rtsp_parser parser;
+	u32 CSeq_now;
+	rtsp_state state_now;
+	_mutex write_lock; //control socket is shared with interleaved rtp senders
+	u8 tx_broken; //interleaved data could not be delivered, server task closes the connection
+	u8 play_pending; //PLAY answered by server task once bound senders stream
+	u32 play_cseq;
+	u32 play_time; //systime PLAY arrived
+	struct rtsp_session_info session_info;
+	rtsp_cc_session *bind; //one binding slot per subsession id
+	u32 last_active; //systime of last request, interleaved data or rtcp receiver report
+	u32 reap_tick; //wheel tick the idle check of this connection is due
+	_list reap_anchor; //link to reaper wheel slot
+}rtsp_client_conn, *p_rtsp_client_conn;
+
+//connections hashed by due tick, a slot holds all rounds, entries lazily rescheduled on expiry
+struct rtsp_reap_wheel
+{
+	_list slot[RTSP_REAP_WHEEL_SLOTS];
+	u32 tick;
+	u32 last_time; //systime wheel was last advanced to
+	u32 reap_cnt; //connections closed for inactivity
+	u32 resched_cnt; //due connections found active again
+};
+
 //struct to store basic configuration for create rtsp server
 typedef struct _rtsp_server_adapter
 {
 	int max_subsession_nb;
+	int max_client_nb;
+	u32 mcast_addr; //multicast group base in host order, 0 for RTSP_MCAST_ADDR_DEF
+	u16 mcast_port; //group rtp port base, 2 * subsession id is added, nonzero fixes the groups and advertises them in sdp
+	u8 mcast_ttl; //ttl of fixed groups, 0 for 1
 	void *ext_adapter;
 }rtsp_server_adapter;
 
@@ -106,12 +206,20 @@ struct rtsp_server{
 	int server_socket;
 	u16 server_port;
 	u8 *server_ip;
-	int client_socket;
-	u8 *client_ip;
-	struct rtsp_message message;
-	u32 CSeq_now;
-	rtsp_state state_now;
+	int max_client_nb;
+	rtsp_client_conn *conn_table[RTSP_MAX_CLIENT_NB];
+	struct rtsp_reactor reactor;
+	volatile int play_pending_cnt; //connections with a deferred PLAY reply, senders wake reactor while nonzero
+	struct rtsp_reap_wheel reaper;
 	rtsp_sm_session server_media;
+	//rtp sender pool, created at launch, one worker per subsession so an attached one never waits
+	_list work_list; //subsessions to serve
+	_mutex work_lock;
+	_sema work_sema; //one token per queued subsession or exit request
+	u8 worker_exit;
+	int worker_nb;
+	ATOMIC_T worker_cnt; //workers alive
+	u32 work_cnt; //subsessions handed to workers
 };
 
 extern int rtsp_req_OPTIONS_cb(void *ext_adapter);
@@ -123,22 +231,34 @@ extern int rtsp_req_TEARDOWN_cb(void *ext_adapter);
 extern int rtsp_req_PAUSE_cb(void *ext_adapter);
 extern int rtsp_req_UNDEFINED_cb(void *ext_adapter);
 
-int rtsp_on_req_OPTIONS(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_DESCRIBE(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_GET_PARAMETER(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_SETUP(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_PLAY(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_TEARDOWN(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_PAUSE(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
-int rtsp_on_req_UNDEFINED(struct rtsp_server *server, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_OPTIONS(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_DESCRIBE(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_GET_PARAMETER(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_SETUP(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_PLAY(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_TEARDOWN(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_PAUSE(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
+int rtsp_on_req_UNDEFINED(rtsp_client_conn *conn, int (*rtsp_req_cb)(void *ext_adapter));
 
 
-int rtsp_parse_request(struct rtsp_message *msg, u8 *request, int size);
+int rtsp_parse_request(struct rtsp_message *msg, struct rtsp_parser *p);
 void rtsp_sm_subsession_free(rtsp_sm_subsession *subsession);
 void rtsp_sm_session_free(rtsp_sm_session *session);
 int rtsp_sm_subsession_add(rtsp_sm_session *session, rtsp_sm_subsession *subsession);
 rtsp_sm_subsession *rtsp_sm_subsession_create(rtp_source_t *src, rtp_sink_t *sink, int max_sdp_size);
+rtsp_client_conn *rtsp_client_conn_create(struct rtsp_server *server, int client_socket, u32 client_addr);
+void rtsp_client_conn_release(rtsp_client_conn *conn);
+int rtsp_client_conn_set_state(rtsp_client_conn *conn, rtsp_state state);
+void rtsp_client_conn_touch(rtsp_client_conn *conn);
+int rtsp_client_conn_write(rtsp_client_conn *conn, u8 *buf, int len);
+int rtsp_client_conn_send_response(rtsp_client_conn *conn, struct rtsp_response *res);
+void rtsp_client_conn_free(rtsp_client_conn *conn);
+int rtsp_cc_session_is_playing(rtsp_cc_session *c);
+int rtsp_sm_subsession_fanout(rtsp_sm_subsession *subsession, struct rtp_frag_list *list);
+rtsp_client_conn *rtsp_server_find_session(struct rtsp_server *server, u32 session_id);
 void rtsp_sm_clear_session(rtsp_sm_session *session);
+void rtsp_sm_session_sdp_changed(rtsp_sm_session *session);
+int rtsp_sm_subsession_set_fmtp(rtsp_sm_subsession *subsession, const char *fmtp);
 void rtsp_sm_clear_all(rtsp_sm_session *session);
 int rtsp_sm_setup(rtsp_sm_session *session, void *parent, int max_subsession_nb, int max_sdp_size);
 struct rtsp_server *rtsp_server_create(rtsp_server_adapter *adapter);
@@ -1,92 +1,104 @@
 #include "platform/platform_stdlib.h"
 #include "basic_types.h"
 #include "sdp.h"
+#include <stdarg.h>
 
+void sdp_writer_init(struct sdp_writer *w, unsigned char *buf, int size)
+{
+        w->buf = buf;
+        w->size = size;
+        w->len = 0;
+        w->err = 0;
+        if(size > 0)
+                buf[0] = '\0';
+}
 
-void sdp_strcat(unsigned char *buf1, int size, unsigned char *buf2)
+//format at cursor, a line that does not fit is cut off entirely
+void sdp_printf(struct sdp_writer *w, const char *fmt, ...)
 {
-        int len1 = strlen(buf1);
-        int len2 = strlen(buf2);
-        int n = size - len1;
-        strncat(buf1, buf2, (n < len2)? n:len2);
+        va_list ap;
+        int room = w->size - w->len;
+        int n;
+        if(w->err || room <= 0)
+        {
+                w->err = -ENOMEM;
+                return;
+        }
+        va_start(ap, fmt);
+        n = vsnprintf((char *)w->buf + w->len, room, fmt, ap);
+        va_end(ap);
+        if(n < 0 || n >= room)
+        {
+                w->buf[w->len] = '\0';
+                w->err = -ENOMEM;
+                return;
+        }
+        w->len += n;
 }
 
-void sdp_fill_o_field(unsigned char *sdp_buf, int size, u8 *username, u32 session_id, u8 session_version, u8* nettype, u8* addrtype, u8* unicast_addr)
+void sdp_fill_o_field(struct sdp_writer *w, u8 *username, u32 session_id, u8 session_version, u8* nettype, u8* addrtype, u8* unicast_addr)
 {
-        unsigned char line[SDP_LINE_LEN] = {0};
-        sprintf(line, "o=%s %x %d %s %s %d.%d.%d.%d" CRLF \
+        sdp_printf(w, "o=%s %x %d %s %s %d.%d.%d.%d" CRLF \
 		            , (username)? username:"-", session_id, session_version, nettype, addrtype, unicast_addr[0], unicast_addr[1], unicast_addr[2], unicast_addr[3]);
-        sdp_strcat(sdp_buf, size, line);
 }
 
-void sdp_fill_s_field(unsigned char *sdp_buf, int size, u8 * session_name)
+void sdp_fill_s_field(struct sdp_writer *w, u8 * session_name)
 {
-        unsigned char line[SDP_LINE_LEN] = {0};
-		sprintf(line, "i=%s" CRLF \
+		sdp_printf(w, "s=%s" CRLF \
 		            , (session_name)? session_name:" ");
-		sdp_strcat(sdp_buf, size, line);
 }
 
-void sdp_fill_i_field(unsigned char *sdp_buf, int size, u8 * session_info)
+void sdp_fill_i_field(struct sdp_writer *w, u8 * session_info)
 {
 
 }
 
-void sdp_fill_u_field(unsigned char * sdp_buf, int size, u8 *uri)
+void sdp_fill_u_field(struct sdp_writer *w, u8 *uri)
 {
 
 }
 
-void sdp_fill_c_field(unsigned char *sdp_buf, int size, u8 *nettype, u8 *addrtype, u8 *connection_addr, u8 ttl)
+void sdp_fill_c_field(struct sdp_writer *w, u8 *nettype, u8 *addrtype, u8 *connection_addr, u8 ttl)
 {
-        unsigned char line[SDP_LINE_LEN] = {0};
 		if(ttl == 0)
 		{
-			sprintf(line, "c=%s %s %d.%d.%d.%d" CRLF \
+			sdp_printf(w, "c=%s %s %d.%d.%d.%d" CRLF \
 						, nettype, addrtype, connection_addr[0], connection_addr[1], connection_addr[2], connection_addr[3]);
 		}else{
-			sprintf(line, "c=%s %s %d.%d.%d.%d/%d" CRLF \
-			            , nettype, addrtype, connection_addr, connection_addr[0], connection_addr[1], connection_addr[2], connection_addr[3], ttl);
+			sdp_printf(w, "c=%s %s %d.%d.%d.%d/%d" CRLF \
+			            , nettype, addrtype, connection_addr[0], connection_addr[1], connection_addr[2], connection_addr[3], ttl);
 		}
-		sdp_strcat(sdp_buf, size, line);
 }
 
-void sdp_fill_b_field(unsigned char *sdp_buf, int size, int bwtype, int bw)
+void sdp_fill_b_field(struct sdp_writer *w, int bwtype, int bw)
 {
-		unsigned char line[SDP_LINE_LEN] = {0};
 		if(bwtype == SDP_BWTYPE_CT)
 		{
-			sprintf(line, "b=CT:%d" CRLF \
+			sdp_printf(w, "b=CT:%d" CRLF \
 			, bw);
 		}else if(bwtype == SDP_BWTYPE_AS)
 			{
-				sprintf(line, "b=AS:%d" CRLF \
+				sdp_printf(w, "b=AS:%d" CRLF \
 							, bw);
-			}else{
-			    return;
 			}
-		sdp_strcat(sdp_buf, size, line);
 }
 
-void sdp_fill_t_field(unsigned char *sdp_buf, int size, u64 start_time, u64 end_time)
+void sdp_fill_t_field(struct sdp_writer *w, u64 start_time, u64 end_time)
 {
-		unsigned char line[SDP_LINE_LEN] = {0};
-		sprintf(line, "t=%d %d" CRLF \
-		            , start_time, end_time);
-		sdp_strcat(sdp_buf, size, line);			
+		sdp_printf(w, "t=%u %u" CRLF \
+		            , (u32)start_time, (u32)end_time);
 }
 
-void sdp_fill_m_field(unsigned char *sdp_buf, int size, int media_type, u16 port, int fmt)
+void sdp_fill_m_field(struct sdp_writer *w, int media_type, u16 port, int fmt)
 {
-		unsigned char line[SDP_LINE_LEN] = {0};
 		switch(media_type)
 		{
 		    case(AVMEDIA_TYPE_VIDEO):
-				sprintf(line, "m=video %d RTP/AVP %d" CRLF \
+				sdp_printf(w, "m=video %d RTP/AVP %d" CRLF \
 							, port, fmt);				
 			    break;
 			case(AVMEDIA_TYPE_AUDIO):
-				sprintf(line, "m=audio %d RTP/AVP %d" CRLF \
+				sdp_printf(w, "m=audio %d RTP/AVP %d" CRLF \
 							, port, fmt);				
 			    break;
 			case(AVMEDIA_TYPE_SUBTITLE):
@@ -94,15 +106,40 @@ void sdp_fill_m_field(unsigned char *sdp_buf, int size, int media_type, u16 port
 			    printf("\n\runsupported media type");
 			    return;
 		}
-		sdp_strcat(sdp_buf, size, line);					
 }
 
-void sdp_fill_a_string(unsigned char *sdp_buf, int size, u8 *string)
+void sdp_fill_a_string(struct sdp_writer *w, u8 *string)
 {
-        unsigned char line[SDP_LINE_LEN] = {0};
-		if((string == NULL) || strlen(string) > SDP_LINE_LEN)
+		if(string == NULL)
 			return;
-		sprintf(line, "a=%s" CRLF \
+		sdp_printf(w, "a=%s" CRLF \
 		            , string);
-		sdp_strcat(sdp_buf, size, line);        					
+}
+
+//rfc 4648 base64 for binary fmtp parameters, return encoded length or -ENOMEM if it does not fit with NUL
+int sdp_base64_encode(const u8 *src, int len, char *dst, int size)
+{
+		static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		char *p = dst;
+		u32 v;
+		if(size < (len + 2) / 3 * 4 + 1)
+			return -ENOMEM;
+		for(; len >= 3; len -= 3, src += 3)
+		{
+			v = (src[0] << 16) | (src[1] << 8) | src[2];
+			*p++ = b64[v >> 18];
+			*p++ = b64[(v >> 12) & 0x3f];
+			*p++ = b64[(v >> 6) & 0x3f];
+			*p++ = b64[v & 0x3f];
+		}
+		if(len > 0)
+		{
+			v = (src[0] << 16) | ((len > 1) ? (src[1] << 8) : 0);
+			*p++ = b64[v >> 18];
+			*p++ = b64[(v >> 12) & 0x3f];
+			*p++ = (len > 1) ? b64[(v >> 6) & 0x3f] : '=';
+			*p++ = '=';
+		}
+		*p = '\0';
+		return p - dst;
 }
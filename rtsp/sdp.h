@@ -6,7 +6,6 @@
 #define CRLF "\r\n"
 #define IS_LINE_END(x) (return *(x)=='\r' || *(x)=='\0')
 #define MAX_SDP_SIZE (512+256)
-#define SDP_LINE_LEN (128+256)
 
 #define SDP_BWTYPE_CT 0
 #define SDP_BWTYPE_AS 1
@@ -20,16 +19,31 @@
 #define SDP_TYPE_TEST 3
 #define SDP_TYPE_H332 4
 
-void sdp_strcat(unsigned char *buf1, int size, unsigned char *buf2);
-void sdp_fill_o_field(unsigned char *sdp_buf, int size, u8 *username, u32 session_id, u8 session_version, u8* nettype, u8* addrtype, u8* unicast_addr);
-void sdp_fill_s_field(unsigned char *sdp_buf, int size, u8 * session_name);
-void sdp_fill_i_field(unsigned char *sdp_buf, int size, u8 * session_info);
-void sdp_fill_u_field(unsigned char * sdp_buf, int size, u8 *uri);
-void sdp_fill_c_field(unsigned char *sdp_buf, int size, u8 *nettype, u8 *addrtype, u8 *connection_addr, u8 ttl);
-void sdp_fill_b_field(unsigned char *sdp_buf, int size, int bwtype, int bw);
-void sdp_fill_t_field(unsigned char *sdp_buf, int size, u64 start_time, u64 end_time);
-void sdp_fill_m_field(unsigned char *sdp_buf, int size, int media_type, u16 port, int fmt);
-void sdp_fill_a_string(unsigned char *sdp_buf, int size, u8 *string);
+/*
+ * Append cursor over a caller owned buffer. Every field is formatted straight
+ * into the tail and the length is tracked, nothing is re-scanned. Output that
+ * does not fit is dropped and flagged in err, buf stays NUL terminated.
+ */
+struct sdp_writer
+{
+	unsigned char *buf;
+	int size;
+	int len;
+	int err;
+};
+
+void sdp_writer_init(struct sdp_writer *w, unsigned char *buf, int size);
+void sdp_printf(struct sdp_writer *w, const char *fmt, ...);
+void sdp_fill_o_field(struct sdp_writer *w, u8 *username, u32 session_id, u8 session_version, u8* nettype, u8* addrtype, u8* unicast_addr);
+void sdp_fill_s_field(struct sdp_writer *w, u8 * session_name);
+void sdp_fill_i_field(struct sdp_writer *w, u8 * session_info);
+void sdp_fill_u_field(struct sdp_writer *w, u8 *uri);
+void sdp_fill_c_field(struct sdp_writer *w, u8 *nettype, u8 *addrtype, u8 *connection_addr, u8 ttl);
+void sdp_fill_b_field(struct sdp_writer *w, int bwtype, int bw);
+void sdp_fill_t_field(struct sdp_writer *w, u64 start_time, u64 end_time);
+void sdp_fill_m_field(struct sdp_writer *w, int media_type, u16 port, int fmt);
+void sdp_fill_a_string(struct sdp_writer *w, u8 *string);
+int sdp_base64_encode(const u8 *src, int len, char *dst, int size);
 
 
 #endif
\ No newline at end of file